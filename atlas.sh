@@ -0,0 +1,101 @@
+#!/bin/sh
+#
+#	@file atlas.sh		@brief Convert the wmc2d XPM into a glyph table.
+#
+#	Copyright (c) 2026 by the wmc2d contributors.
+#
+#	Contributor(s):
+#
+#	License: AGPLv3
+#
+#	This program is free software: you can redistribute it and/or modify
+#	it under the terms of the GNU Affero General Public License as
+#	published by the Free Software Foundation, either version 3 of the
+#	License.
+#
+#	This program is distributed in the hope that it will be useful,
+#	but WITHOUT ANY WARRANTY; without even the implied warranty of
+#	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#	GNU Affero General Public License for more details.
+#
+#	$Id$
+#----------------------------------------------------------------------------
+#
+#	Usage: atlas.sh wmc2d.xpm > wmc2d-atlas.h
+#
+#	Writes the XPM as C tables: the colors as 0x00RRGGBB (0xFF000000 is
+#	transparent) and the color index of every pixel.  wmc2d builds its
+#	glyph atlas from them without parsing the XPM at startup.
+#	Supports the same XPM subset as XcbXpm2Image(): 1 char per pixel,
+#	#RRGGBB or None colors.
+#
+
+XPM=${1:?"Usage: $0 file.xpm"}
+
+awk '
+/^"/ {
+	s = $0
+	sub(/^"/, "", s)
+	sub(/"[^"]*$/, "", s)
+	if (!n++) {
+		split(s, header, " ")
+		w = header[1]; h = header[2]; colors = header[3]
+		if (header[4] != 1 || colors > 255) {
+			print "atlas.sh: unsupported XPM" > "/dev/stderr"
+			exit 1
+		}
+		printf("/* generated by atlas.sh from %s, do not edit */\n\n",
+			FILENAME)
+		printf("#define ATLAS_WIDTH %d\t\t///< atlas width\n", w)
+		printf("#define ATLAS_HEIGHT %d\t\t///< atlas height\n", h)
+		printf("#define ATLAS_COLORS %d\t\t///< atlas colors\n\n",
+			colors)
+		printf("    /// atlas colors 0x00RRGGBB, ")
+		printf("0xFF000000 is transparent\n")
+		printf("static const uint32_t AtlasColors[ATLAS_COLORS] = {\n")
+		next
+	}
+	if (n <= colors + 1) {
+		index_of[substr(s, 1, 1)] = n - 2
+		k = split(substr(s, 2), spec, " ")
+		color = ""
+		for (i = 1; i < k; ++i) {
+			if (spec[i] == "c") {
+				color = spec[i + 1]
+			}
+		}
+		if (tolower(color) == "none") {
+			color = "0xFF000000"
+		} else if (color ~ /^#[0-9A-Fa-f][0-9A-Fa-f][0-9A-Fa-f][0-9A-Fa-f][0-9A-Fa-f][0-9A-Fa-f]$/) {
+			color = "0x00" toupper(substr(color, 2))
+		} else {
+			print "atlas.sh: unsupported color " s > "/dev/stderr"
+			exit 1
+		}
+		printf("    %s,\n", color)
+		if (n == colors + 1) {
+			printf("};\n\n    /// atlas pixels, index into ")
+			printf("AtlasColors\n")
+			printf("static const uint8_t ")
+			printf("AtlasPixels[ATLAS_HEIGHT][ATLAS_WIDTH] = {\n")
+		}
+		next
+	}
+	if (length(s) != w) {
+		print "atlas.sh: wrong width " s > "/dev/stderr"
+		exit 1
+	}
+	line = "    {"
+	for (i = 1; i <= w; ++i) {
+		line = line index_of[substr(s, i, 1)] (i < w ? "," : "},")
+		if (length(line) > 72 && i < w) {
+			print line
+			line = "\t"
+		}
+	}
+	print line
+	if (n == colors + 1 + h) {
+		print "};"
+	}
+}
+' "$XPM"
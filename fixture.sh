@@ -0,0 +1,90 @@
+#!/bin/sh
+#
+#	@file fixture.sh	@brief Build a synthetic sysfs tree for wmc2d.
+#
+#	Copyright (c) 2026 by the wmc2d contributors.
+#
+#	Contributor(s):
+#
+#	License: AGPLv3
+#
+#	This program is free software: you can redistribute it and/or modify
+#	it under the terms of the GNU Affero General Public License as
+#	published by the Free Software Foundation, either version 3 of the
+#	License.
+#
+#	This program is distributed in the hope that it will be useful,
+#	but WITHOUT ANY WARRANTY; without even the implied warranty of
+#	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#	GNU Affero General Public License for more details.
+#
+#	$Id$
+#----------------------------------------------------------------------------
+#
+#	Usage: fixture.sh dir [cpus [packages [threads]]]
+#
+#	Creates dir/sys with coretemp hwmon, cpu topology, cpufreq, thermal
+#	throttle counters and two ACPI thermal zones for cpus logical cpus.
+#	Use it with wmc2d -R dir.
+#	Linux numbering: hyper-threading siblings are cpus / threads apart.
+#
+
+DIR=${1:?"Usage: $0 dir [cpus [packages [threads]]]"}
+CPUS=${2:-4}
+PACKAGES=${3:-1}
+THREADS=${4:-1}
+
+CORES=$((CPUS / THREADS / PACKAGES))
+if [ "$CORES" -lt 1 ] || [ $((CORES * THREADS * PACKAGES)) -ne "$CPUS" ]; then
+	echo "$0: $CPUS cpus can't be split into $PACKAGES packages" \
+		"with $THREADS threads" >&2
+	exit 1
+fi
+
+SYS="$DIR/sys"
+
+#	one coretemp hwmon per package
+p=0
+while [ $p -lt "$PACKAGES" ]; do
+	hwmon="$SYS/class/hwmon/hwmon$p"
+	mkdir -p "$hwmon"
+	echo coretemp > "$hwmon/name"
+	echo "Package id $p" > "$hwmon/temp1_label"
+	echo $((50000 + p * 1000)) > "$hwmon/temp1_input"
+	c=0
+	while [ $c -lt "$CORES" ]; do
+		n=$((c + 2))
+		echo "Core $c" > "$hwmon/temp${n}_label"
+		echo $((40000 + (c * 7 + p * 3) % 40 * 1000)) \
+			> "$hwmon/temp${n}_input"
+		echo 0 > "$hwmon/temp${n}_crit_alarm"
+		c=$((c + 1))
+	done
+	p=$((p + 1))
+done
+
+#	topology and cpufreq of all logical cpus
+cpu=0
+while [ $cpu -lt "$CPUS" ]; do
+	core=$((cpu % (CORES * PACKAGES)))
+	d="$SYS/devices/system/cpu/cpu$cpu"
+	mkdir -p "$d/topology" "$d/cpufreq" "$d/thermal_throttle"
+	echo $((core / CORES)) > "$d/topology/physical_package_id"
+	echo $((core % CORES)) > "$d/topology/core_id"
+	echo $((800000 + (cpu * 13) % 28 * 100000)) \
+		> "$d/cpufreq/scaling_cur_freq"
+	for t in core package; do
+		echo 0 > "$d/thermal_throttle/${t}_throttle_count"
+		echo 0 > "$d/thermal_throttle/${t}_throttle_total_time_ms"
+	done
+	cpu=$((cpu + 1))
+done
+
+#	thermal zones
+z=0
+while [ $z -lt 2 ]; do
+	mkdir -p "$SYS/class/thermal/thermal_zone$z"
+	echo acpitz > "$SYS/class/thermal/thermal_zone$z/type"
+	echo $((27800 + z * 10000)) > "$SYS/class/thermal/thermal_zone$z/temp"
+	z=$((z + 1))
+done
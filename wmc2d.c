@@ -28,8 +28,11 @@
 **	@mainpage
 **
 **	This is a small dockapp, which shows the core temperature and cpu
-**	frequency from 2 upto 4 cores/cpus and the temperature of upto two
-**	thermal zones, which are normaly the motherboard temperature.
+**	frequency from 2 upto any number of cores/cpus and the temperature
+**	of upto 16 thermal zones, which are normaly the motherboard
+**	temperature.  Cpus and zones, which don't fit at once, are paged.
+**	Many cpus can also be aggregated, drawn as a graph or spread over
+**	several windows of one process.
 **	@n
 **	All cpus, which are supported by the linux kernel "coretemp" and
 **	"cpufreq" modules, could be monitored. f.e. core 2, atom and core ix.
@@ -40,33 +43,75 @@
 **	@n
 **	To compile you must have libxcb (xcb-dev) installed.
 **	@n
-**	The source is a single file with less than 1200 lines. The sources
+**	The source is a single file with about 6400 lines. The sources
 **	are (hopefully) good documented.  They can be used as an example,
 **	how to write your own dockapp, applet or widget.
 **	@n
 **	Started with version 2.04 the number of cpus and thermal zones
 **	can be configured.  The background is no longer stored in the xpm;
 **	it is now dynamic generated. See older version for a simpler example.
+**	@n
+**	The sensors are sampled by an own thread, which publishes the values
+**	through a seqlock snapshot.  The X11 thread only draws the latest
+**	snapshot, a slow sensor didn't delay the X11 event handling.
 */
 
 ////////////////////////////////////////////////////////////////////////////
 
 #define SCREENSAVER			///< config support screensaver
+#define DPMS				///< config support DPMS monitor power
+#define IO_URING			///< config io_uring sensor sampling
+#define MIT_SHM				///< config shared memory frame buffer
+#define PRECOMPILED_ATLAS		///< config glyph table from atlas.sh
+#define EFFECTIVE_FREQ			///< config APERF/MPERF frequency
+#define DOCKAPP_MAX 16			///< config max. windows per process
+#define ZONE_MAX 16			///< config max. thermal zones
 
 ////////////////////////////////////////////////////////////////////////////
 
+#define _GNU_SOURCE			///< ppoll
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <limits.h>
 #include <string.h>
 #include <poll.h>
 #include <ctype.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/ipc.h>
 #include <sys/shm.h>
+#include <sys/syscall.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <dirent.h>
+#include <linux/netlink.h>
+
+#if defined(IO_URING) && !defined(__NR_io_uring_setup)
+#undef IO_URING				// kernel headers too old, fallback
+#endif
+#ifdef IO_URING
+#include <linux/io_uring.h>
+#endif
+
+#if defined(EFFECTIVE_FREQ) && !defined(__x86_64__) && !defined(__i386__)
+#undef EFFECTIVE_FREQ			// needs x86 APERF/MPERF and TSC
+#endif
+#ifdef EFFECTIVE_FREQ
+#include <x86intrin.h>
+#include <linux/perf_event.h>
+#endif
 
 #include <xcb/xcb.h>
 #include <xcb/shm.h>
@@ -79,55 +124,427 @@
 #ifdef SCREENSAVER
 #include <xcb/screensaver.h>
 #endif
+#ifdef DPMS
+#include <xcb/dpms.h>
+#include <xcb/xcbext.h>
+#endif
 
 #include "wmc2d.xpm"
+#ifdef PRECOMPILED_ATLAS
+#include "wmc2d-atlas.h"
+#endif
 
 ////////////////////////////////////////////////////////////////////////////
 
 xcb_connection_t *Connection;		///< connection to X11 server
 xcb_screen_t *Screen;			///< our screen
-xcb_window_t Window;			///< our window
 xcb_gcontext_t NormalGC;		///< normal graphic context
-xcb_pixmap_t Pixmap;			///< our background pixmap
 
 xcb_pixmap_t Image;			///< drawing data
 
+xcb_image_t *Atlas;			///< client side drawing data
+
+    /// root visual, if TrueColor: pixels are computed locally
+static const xcb_visualtype_t *TrueColor;
+
+/**
+**	Display cell, remembers the last drawn value at a position.
+*/
+typedef struct _cell_
+{
+    int16_t X;				///< x pixel position
+    int16_t Y;				///< y pixel position
+    unsigned Value;			///< last drawn value
+} Cell;
+
+#define SLOT_MAX 16			///< max. cpus displayed at once
+#define LAYOUT_MAX 32			///< max. elements of a layout
+
+/**
+**	Compiled draw command of a layout value slot.
+**
+**	Bound at startup to a value slot, the per update path only walks
+**	the list: no layout decisions, one branch per command.
+*/
+typedef struct _draw_command_
+{
+    void (*Draw[2]) (unsigned, int, int);	///< normal, alternative draw
+    const int *Value;			///< bound value slot
+    const char *Alt;			///< true: use alternative draw (turbo)
+    int Min;				///< smaller values aren't drawn
+    int16_t Div;			///< divisor of value for display
+    int16_t X;				///< x pixel position
+    int16_t Y;				///< y pixel position
+} DrawCommand;
+
+/**
+**	One dockapp window.
+**
+**	All windows share the connection, the glyph atlas and the sampler,
+**	each has its own frame buffer, cpu range and layout.
+*/
+typedef struct _dockapp_
+{
+    xcb_window_t Window;		///< our window
+    xcb_pixmap_t Pixmap;		///< our background pixmap
+    xcb_image_t *Frame;			///< client side frame buffer
+#ifdef MIT_SHM
+    xcb_shm_segment_info_t FrameShm;	///< shared memory of frame buffer
+    char ShmBusy;			///< server still reads frame buffer
+#endif
+    char Aggregate;			///< show min/max/mean of all cpus
+    char Graph;				///< show graph of the hottest cpu
+    char GraphDirty;			///< graph must be completely drawn
+    char Unmapped;			///< window is unmapped
+    char Obscured;			///< window is fully obscured
+
+    int DamageX1;			///< damaged area upper left x
+    int DamageY1;			///< damaged area upper left y
+    int DamageX2;			///< damaged area lower right x
+    int DamageY2;			///< damaged area lower right y
+
+    int StartCpu;			///< first cpu nr. to use
+    int Cpus;				///< number of cpus
+    int Slots;				///< number of cpus displayed at once
+    int CpuFirst;			///< first cpu of displayed page
+    int Pages;				///< updates since last page
+    char JoinTemp;			///< -J, not for 2 cpus
+    char JoinFreq;			///< -j, not for 2 cpus
+
+    int *CpuTempSensors;		///< cpu temperature sensor handles
+    int *CpuTempCpus;			///< logical cpu of temperature sensor
+    int (*CpuFreqSensors)[2];		///< cpu frequency sensor handles
+    int (*CpuThrottleSensors)[4];	///< core/package counts of both cpus
+
+    Cell Cells[32];			///< all display cells
+    int CellN;				///< number of display cells
+
+    DrawCommand Commands[LAYOUT_MAX];	///< compiled layout
+    int CommandN;			///< number of draw commands
+
+    uint64_t HeadlessShape[64];		///< headless: window shape bitmap
+} Dockapp;
+
+static Dockapp Dockapps[DOCKAPP_MAX];	///< all dockapp windows
+static int DockappN;			///< number of dockapp windows
+static Dockapp *Dock;			///< current dockapp window
+
+static unsigned Ticks;			///< number of updates
+static unsigned SkippedTicks;		///< updates without X11 requests
+
+#ifdef MIT_SHM
+int ShmCompletionEventId;		///< shm completion event id
+#endif
+
 #ifdef SCREENSAVER
 int ScreenSaverEventId;			///< screen saver event ids
 #endif
 
+#ifdef DPMS
+#define DPMS_CHECK 5000			///< ms between DPMS state queries
+
+static char UseDpms;			///< DPMS extension available
+static char DpmsPending;		///< DPMS info request sent
+static xcb_dpms_info_cookie_t DpmsCookie;	///< pending DPMS info request
+static uint64_t DpmsNext;		///< ns of the next DPMS query
+#endif
+
+/**
+**	Reasons, why sampling and rendering are suspended.
+*/
+enum _suspend_
+{
+    SUSPEND_SCREENSAVER = 1,		///< screensaver is running
+    SUSPEND_HIDDEN = 2,			///< all windows unmapped or obscured
+    SUSPEND_DPMS = 4,			///< monitor is powered down
+};
+
+static int Suspended;			///< suspend reasons, 0 running
+static unsigned SuspendCount;		///< number of suspends
+static uint64_t SuspendStart;		///< start of current suspend in ns
+static uint64_t SuspendTime;		///< time spent suspended in ns
+
 static int Rate;			///< update rate in ms
+static int RateMin;			///< adaptive: fastest update rate in ms
+static int RateMax;			///< adaptive: slowest rate, 0 fixed rate
+static int RateNext;			///< update rate wanted by the sampler
+static int TimerSlack;			///< timer slack in us
+static int TimerFD = -1;		///< eventfd: update timer re-armed
+static int64_t TimerRequest = -1;	///< rate * 2 + now, -1 none
+static char SamplerQuit;		///< sampler thread should end
+static int SampleFD = -1;		///< eventfd: new snapshot available
+static unsigned MissedTicks;		///< updates coalesced by the timer
+static uint64_t TimerNext;		///< next update in ns, sampler only
+static uint64_t TimerInterval;		///< update interval in ns, 0 stopped
+static int SignalFD = -1;		///< signalfd: SIGUSR1 dumps metrics
 static char WindowMode;			///< start in window mode
-static char UseSleep;			///< use sleep while screensaver runs
-static char StartCpu;			///< first cpu nr. to use
-static char Cpus;			///< number of cpus
+static char UseSleep;			///< use sleep while output is unseen
+static int PageTicks;			///< updates before next page of cpus
+static int Layout;			///< cpus shown at once, 0 automatic
 static char JoinCpusTemp;		///< aggregate numbers of two cpus
 static char JoinCpusFreq;		///< aggregate numbers of two cpus
 static char ThermalZones;		///< number of thermal zones
 static int TurboBoostFreq;		///< >= turbo boost frequency
+static char Verbose;			///< print statistics
+static char EffectiveFreq;		///< use effective frequency
+static char ThrottleShow;		///< show throttled cpus in red
+static const char *SysRoot;		///< root directory of sysfs paths
+static int SysRootFD = -1;		///< opened root, -1 for real "/"
+static int BenchTicks;			///< run benchmark with n updates
+static const char *HeadlessName;	///< headless: PPM frame file name
+static const char *ExportName;		///< shared memory name for export
+static const char *RecordName;		///< record file name and size
+static const char *ReplayName;		///< replay: record file name
+static char ReplayFast;			///< replay as fast as possible
+static char ReplayDone;			///< last recorded update was shown
 
-    /// thermal zone names
-static const char *ThermalZoneNames[] = {
+    /// thermal zone names, file names or zone type/hwmon label
+static const char *ThermalZoneNames[ZONE_MAX] = {
     "/sys/class/thermal/thermal_zone0/temp",
     "/sys/class/thermal/thermal_zone1/temp",
 };
 
-    /// coretemp thermal sensor names
-    /// FIXME: make this configurable
-static const char * CoreThermalNames =
-    "/sys/devices/platform/coretemp.0/hwmon/hwmon1/temp2_input";
+    /// coretemp thermal sensor names, sensor number and "_input" appended
+    /// only used, if the hwmon discovery found no coretemp sensors
+static const char *CoreThermalNames =
+    "/sys/devices/platform/coretemp.0/hwmon/hwmon1/temp";
 
 extern void Timeout(void);		///< called from event loop
+static void MetricsDump(void);		///< print latency histograms
+static int HistoryGet(int, unsigned);	///< older value of a sensor
+
+////////////////////////////////////////////////////////////////////////////
+//	Metrics Stuff
+////////////////////////////////////////////////////////////////////////////
+
+#define HISTOGRAM_BUCKETS 40		///< log2 buckets, upto 2^39 ns
+
+/**
+**	Latency histogram with logarithmic buckets.
+**
+**	Bucket i counts latencies < 2^i ns.  Adding a sample costs a
+**	count leading zeros and an increment.
+*/
+typedef struct _histogram_
+{
+    uint32_t Count[HISTOGRAM_BUCKETS];	///< samples per bucket
+    uint32_t N;				///< number of samples
+    uint64_t Max;			///< maximal sample in ns
+} Histogram;
+
+static Histogram LatenessHistogram;	///< timer expiration to wakeup
+static Histogram SampleHistogram;	///< sampling all sensors
+static Histogram RenderHistogram;	///< drawing and composing the frame
+static Histogram FlushHistogram;	///< xcb_flush
+static Histogram *SensorHistograms;	///< read latency of each sensor
+static uint64_t StartTime;		///< process start in ns
+static uint64_t FirstFrameTime;		///< start to first frame sent in ns
+
+/**
+**	Monotonic time in nanoseconds (vdso, no syscall).
+*/
+static inline uint64_t NowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+**	Add a sample to a latency histogram.
+**
+**	@param histogram	latency histogram
+**	@param ns		latency in nanoseconds
+*/
+static inline void HistogramAdd(Histogram * histogram, uint64_t ns)
+{
+    int i;
+
+    i = ns ? 64 - __builtin_clzll(ns) : 0;
+    if (i >= HISTOGRAM_BUCKETS) {
+	i = HISTOGRAM_BUCKETS - 1;
+    }
+    ++histogram->Count[i];
+    ++histogram->N;
+    if (ns > histogram->Max) {
+	histogram->Max = ns;
+    }
+}
+
+/**
+**	Get a percentile of a latency histogram.
+**
+**	@param histogram	latency histogram
+**	@param percent		percentile (f.e. 50 or 99)
+**
+**	@returns upper bound of the percentile in nanoseconds.
+*/
+static uint64_t HistogramPercentile(const Histogram * histogram,
+    unsigned percent)
+{
+    uint64_t n;
+    uint64_t sum;
+    int i;
+
+    n = ((uint64_t) histogram->N * percent + 99) / 100;
+    sum = 0;
+    for (i = 0; i < HISTOGRAM_BUCKETS - 1; ++i) {
+	sum += histogram->Count[i];
+	if (sum >= n) {
+	    break;
+	}
+    }
+    // bucket upper bound, but not above the seen maximum
+    return i && 1ULL << i < histogram->Max ? 1ULL << i : histogram->Max;
+}
+
+/**
+**	Print a latency histogram summary.
+**
+**	@param name		name of the histogram
+**	@param histogram	latency histogram
+*/
+static void HistogramPrint(const char *name, const Histogram * histogram)
+{
+    printf("%s: n=%u p50<=%.1fus p99<=%.1fus max=%.1fus\n", name,
+	histogram->N, HistogramPercentile(histogram, 50) / 1e3,
+	HistogramPercentile(histogram, 99) / 1e3, histogram->Max / 1e3);
+}
 
 ////////////////////////////////////////////////////////////////////////////
 //	XPM Stuff
 ////////////////////////////////////////////////////////////////////////////
 
+/**
+**	Create a headless image, 32 bit pixels 0x00RRGGBB in host order.
+**
+**	@param w	width of image
+**	@param h	height of image
+**
+**	@returns the image, NULL on failure.
+*/
+static xcb_image_t *HeadlessImageCreate(int w, int h)
+{
+    return xcb_image_create(w, h, XCB_IMAGE_FORMAT_Z_PIXMAP, 32, 24, 32, 32,
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	XCB_IMAGE_ORDER_MSB_FIRST, XCB_IMAGE_ORDER_MSB_FIRST,
+#else
+	XCB_IMAGE_ORDER_LSB_FIRST, XCB_IMAGE_ORDER_LSB_FIRST,
+#endif
+	NULL, 0, NULL);
+}
+
+/**
+**	Find the TrueColor visual of the root window.
+**
+**	@param screen	our screen
+**
+**	@returns the root visual, NULL if it isn't TrueColor.
+*/
+static const xcb_visualtype_t *TrueColorVisual(const xcb_screen_t * screen)
+{
+    xcb_depth_iterator_t depths;
+    xcb_visualtype_iterator_t visuals;
+
+    for (depths = xcb_screen_allowed_depths_iterator(screen); depths.rem;
+	xcb_depth_next(&depths)) {
+	for (visuals = xcb_depth_visuals_iterator(depths.data); visuals.rem;
+	    xcb_visualtype_next(&visuals)) {
+	    if (visuals.data->visual_id == screen->root_visual) {
+		return visuals.data->_class ==
+		    XCB_VISUAL_CLASS_TRUE_COLOR ? visuals.data : NULL;
+	    }
+	}
+    }
+    return NULL;
+}
+
+/**
+**	Scale an 8 bit color channel into a TrueColor pixel mask.
+**
+**	@param mask	channel mask of the visual
+**	@param value	8 bit channel value
+*/
+static inline uint32_t TrueColorChannel(uint32_t mask, uint32_t value)
+{
+    int shift;
+
+    if (!mask) {
+	return 0;
+    }
+    shift = __builtin_ctz(mask);
+    return ((value & 0xFF) * (mask >> shift) / 255) << shift;
+}
+
+/**
+**	Compute the pixel of a color, without alloc color round trip.
+**
+**	@param visual	TrueColor visual, NULL headless
+**	@param rgb	color 0x00RRGGBB
+**
+**	@returns the pixel, headless it is the color.
+*/
+static uint32_t TrueColorPixel(const xcb_visualtype_t * visual, uint32_t rgb)
+{
+    if (!visual) {
+	return rgb;
+    }
+    return TrueColorChannel(visual->red_mask, rgb >> 16)
+	| TrueColorChannel(visual->green_mask, rgb >> 8)
+	| TrueColorChannel(visual->blue_mask, rgb);
+}
+
+/**
+**	Fill one image row from color indices.
+**
+**	@param image	destination image
+**	@param y	row
+**	@param indices	color index of each pixel
+**	@param pixels	pixel of each color index
+**
+**	Host order 32 and 16 bit Z pixmaps are written as whole row, other
+**	formats pixel by pixel.
+*/
+static void ImageFillRow(xcb_image_t * image, int y, const uint8_t * indices,
+    const uint32_t * pixels)
+{
+    const int host_order = __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__ ?
+	XCB_IMAGE_ORDER_MSB_FIRST : XCB_IMAGE_ORDER_LSB_FIRST;
+    int x;
+
+    if (image->format == XCB_IMAGE_FORMAT_Z_PIXMAP
+	&& image->byte_order == host_order) {
+	if (image->bpp == 32) {
+	    uint32_t *row;
+
+	    row = (uint32_t *) (image->data + y * image->stride);
+	    for (x = 0; x < image->width; ++x) {
+		row[x] = pixels[indices[x]];
+	    }
+	    return;
+	}
+	if (image->bpp == 16) {
+	    uint16_t *row;
+
+	    row = (uint16_t *) (image->data + y * image->stride);
+	    for (x = 0; x < image->width; ++x) {
+		row[x] = pixels[indices[x]];
+	    }
+	    return;
+	}
+    }
+    for (x = 0; x < image->width; ++x) {
+	xcb_image_put_pixel(image, x, y, pixels[indices[x]]);
+    }
+}
+
 /**
 **	Convert XPM graphic to xcb_image.
 **
-**	@param connection	XCB connection to X11 server
+**	@param connection	XCB connection to X11 server, NULL headless
 **	@param colormap		window colormap
+**	@param visual		TrueColor visual or NULL to allocate colors
 **	@param depth		image depth
 **	@param transparent	pixel for transparent color
 **	@param data		XPM graphic data
@@ -135,11 +552,16 @@ extern void Timeout(void);		///< called from event loop
 **
 **	@returns image create from the XPM data.
 **
+**	Without connection a 32 bit 0x00RRGGBB image is created, the pixels
+**	are the XPM colors and no server is needed.  With a TrueColor visual
+**	the pixels are computed from the visual masks, without waiting for
+**	one alloc color reply per color.
+**
 **	@warning supports only a subset of XPM formats.
 */
 xcb_image_t *XcbXpm2Image(xcb_connection_t * connection,
-    xcb_colormap_t colormap, uint8_t depth, uint32_t transparent,
-    const char *const *data, uint8_t ** mask)
+    xcb_colormap_t colormap, const xcb_visualtype_t * visual, uint8_t depth,
+    uint32_t transparent, const char *const *data, uint8_t ** mask)
 {
     // convert table: ascii hex nibble to binary
     static const uint8_t hex[128] =
@@ -161,7 +583,8 @@ xcb_image_t *XcbXpm2Image(xcb_connection_t * connection,
     int i;
     xcb_alloc_color_cookie_t cookies[256];
     int color_to_pixel[256];
-    uint32_t pixels[256];
+    uint32_t pixels[256 + 1];
+    uint8_t *row;
     xcb_image_t *image;
     int mask_width;
     const char *line;
@@ -193,6 +616,7 @@ xcb_image_t *XcbXpm2Image(xcb_connection_t * connection,
 	id = *line++;
 	color_to_pixel[id] = i;		// maps xpm color char to pixel
 	cookies[i].sequence = 0;
+	pixels[i] = 0UL;		// transparent or error
 	while (*line) {			// multiple choices for color
 	    int r;
 	    int g;
@@ -229,6 +653,19 @@ xcb_image_t *XcbXpm2Image(xcb_connection_t * connection,
 		b = (hex[line[0] & 0xFF] << 4) | hex[line[1] & 0xFF];
 		line += 2;
 	    }
+	    if (!connection) {		// headless: pixel is the color
+		if (type == 'c') {
+		    pixels[i] = (r << 16) | (g << 8) | b;
+		}
+		continue;
+	    }
+	    if (visual && depth != 1) {	// TrueColor: no round trip
+		if (type == 'c') {
+		    pixels[i] =
+			TrueColorPixel(visual, (r << 16) | (g << 8) | b);
+		}
+		continue;
+	    }
 
 	    // 8bit rgb -> 16bit
 	    r = (65535 * (r & 0xFF) / 255);
@@ -251,7 +688,7 @@ xcb_image_t *XcbXpm2Image(xcb_connection_t * connection,
     //
     //	Fetch the replies
     //
-    for (i = 0; i < colors; i++) {
+    for (i = 0; connection && i < colors; i++) {
 	xcb_alloc_color_reply_t *reply;
 
 	if (cookies[i].sequence) {
@@ -262,23 +699,30 @@ xcb_image_t *XcbXpm2Image(xcb_connection_t * connection,
 	    }
 	    pixels[i] = reply->pixel;
 	    free(reply);
-	} else {
-	    // transparent or error
-	    pixels[i] = 0UL;
 	}
     }
 
     if (depth == 1) {
 	transparent = 1;
     }
+    pixels[colors] = transparent;
 
-    image =
-	xcb_image_create_native(connection, w, h,
-	(depth == 1) ? XCB_IMAGE_FORMAT_XY_BITMAP : XCB_IMAGE_FORMAT_Z_PIXMAP,
-	depth, NULL, 0L, NULL);
+    if (!connection) {
+	image = HeadlessImageCreate(w, h);
+    } else {
+	image =
+	    xcb_image_create_native(connection, w, h,
+	    (depth ==
+		1) ? XCB_IMAGE_FORMAT_XY_BITMAP : XCB_IMAGE_FORMAT_Z_PIXMAP,
+	    depth, NULL, 0L, NULL);
+    }
     if (!image) {			// failure
 	return image;
     }
+    if (!(row = malloc(w))) {		// malloc failure
+	xcb_image_destroy(image);
+	return NULL;
+    }
     //
     //	Allocate empty mask (if mask is requested)
     //
@@ -300,18 +744,64 @@ xcb_image_t *XcbXpm2Image(xcb_connection_t * connection,
 	for (x = 0; x < w; x++) {
 	    i = color_to_pixel[*line++ & 0xFF];
 	    if (i == -1) {		// marks transparent
-		xcb_image_put_pixel(image, x, y, transparent);
+		i = colors;
 		if (mask) {
 		    (*mask)[(y * mask_width) + (x >> 3)] &= (~(1 << (x & 7)));
 		}
-	    } else {
-		xcb_image_put_pixel(image, x, y, pixels[i]);
 	    }
+	    row[x] = i;
 	}
+	ImageFillRow(image, y, row, pixels);
+    }
+    free(row);
+    return image;
+}
+
+#ifdef PRECOMPILED_ATLAS
+
+/**
+**	Create the glyph atlas from the table generated by atlas.sh.
+**
+**	@returns the atlas image, NULL if the colors must be allocated.
+**
+**	Headless the pixels are the colors, with a TrueColor visual they
+**	are computed from the visual masks.  No XPM is parsed and no server
+**	round trip is needed.
+*/
+static xcb_image_t *AtlasCreate(void)
+{
+    uint32_t pixels[ATLAS_COLORS];
+    xcb_image_t *image;
+    int i;
+    int y;
+
+    if (Connection && !TrueColor) {
+	return NULL;
+    }
+    for (i = 0; i < ATLAS_COLORS; ++i) {	// transparent is pixel 0
+	pixels[i] =
+	    AtlasColors[i] >> 24 ? 0UL : TrueColorPixel(TrueColor,
+	    AtlasColors[i]);
+    }
+    if (!Connection) {
+	image = HeadlessImageCreate(ATLAS_WIDTH, ATLAS_HEIGHT);
+    } else {
+	image =
+	    xcb_image_create_native(Connection, ATLAS_WIDTH, ATLAS_HEIGHT,
+	    XCB_IMAGE_FORMAT_Z_PIXMAP, Screen->root_depth, NULL, 0L, NULL);
+    }
+    if (!image) {
+	return NULL;
+    }
+    for (y = 0; y < ATLAS_HEIGHT; ++y) {
+	ImageFillRow(image, y, AtlasPixels[y], pixels);
     }
     return image;
 }
 
+#endif
+
+
 ////////////////////////////////////////////////////////////////////////////
 
 /**
@@ -329,21 +819,21 @@ xcb_pixmap_t CreatePixmap(const char *const *data, xcb_pixmap_t * mask)
     xcb_image_t *image;
 
     image =
-	XcbXpm2Image(Connection, Screen->default_colormap, Screen->root_depth,
-	0UL, data, mask ? &bitmap : NULL);
+	XcbXpm2Image(Connection, Screen->default_colormap, TrueColor,
+	Screen->root_depth, 0UL, data, mask ? &bitmap : NULL);
     if (!image) {
 	fprintf(stderr, "Can't create image\n");
 	abort();
     }
     if (mask) {
 	*mask =
-	    xcb_create_pixmap_from_bitmap_data(Connection, Window, bitmap,
-	    image->width, image->height, 1, 0, 0, NULL);
+	    xcb_create_pixmap_from_bitmap_data(Connection, Dock->Window,
+	    bitmap, image->width, image->height, 1, 0, 0, NULL);
 	free(bitmap);
     }
     // now get data from image and build a pixmap...
     pixmap = xcb_generate_id(Connection);
-    xcb_create_pixmap(Connection, Screen->root_depth, pixmap, Window,
+    xcb_create_pixmap(Connection, Screen->root_depth, pixmap, Dock->Window,
 	image->width, image->height);
     xcb_image_put(Connection, pixmap, NormalGC, image, 0, 0, 0);
 
@@ -352,136 +842,768 @@ xcb_pixmap_t CreatePixmap(const char *const *data, xcb_pixmap_t * mask)
     return pixmap;
 }
 
+////////////////////////////////////////////////////////////////////////////
+//	Frame Stuff
 ////////////////////////////////////////////////////////////////////////////
 
 /**
-**	Loop
+**	Setup the client side frame buffer.
+**
+**	The glyph atlas is decoded once from the XPM and kept on the client,
+**	the whole 64x64 frame is composed from it and pushed with one
+**	request.  The frame buffer is in a MIT-SHM segment, if the server
+**	supports it, otherwise it is send with a plain put image.
+**
+**	@param data	XPM data of the glyph atlas
+**
+**	@returns 0 on success, -1 if the server side pixmap must be used.
 */
-void Loop(void)
+int FrameSetup(const char *const *data)
 {
-    struct pollfd fds[1];
-    xcb_generic_event_t *event;
-    int n;
-    int delay;
-
-    fds[0].fd = xcb_get_file_descriptor(Connection);
-    fds[0].events = POLLIN | POLLPRI;
-
-    delay = Rate;			// default 1500ms delay between updates
-    for (;;) {
-	n = poll(fds, 1, delay);
-	if (n < 0) {
-	    return;
-	}
-	if (n) {
-	    if (fds[0].revents & (POLLIN | POLLPRI)) {
-		if ((event = xcb_poll_for_event(Connection))) {
+    xcb_image_t *image;
 
-		    switch (event->
-			response_type & XCB_EVENT_RESPONSE_TYPE_MASK) {
-			case XCB_EXPOSE:
-			    // background pixmap no need to redraw
-#if 0
-			    // collapse multi expose
-			    if (!((xcb_expose_event_t *) event)->count) {
-				xcb_clear_area(Connection, 0, Window, 0, 0, 64,
-				    64);
-				// flush the request
-				xcb_flush(Connection);
-			    }
-#endif
-			    break;
-			case XCB_DESTROY_NOTIFY:
-			    // window destroyed, exit application
-			    return;
-			case 0:
-			    // error_code
-			    // printf("error %x\n", event->response_type);
-			    break;
-			default:
-			    // Unknown event type, ignore it
-			    // printf("unknown %x\n", event->response_type);
-#ifdef SCREENSAVER
-			    if (XCB_EVENT_RESPONSE_TYPE(event) ==
-				ScreenSaverEventId) {
-				xcb_screensaver_notify_event_t *sse;
-
-				sse = (xcb_screensaver_notify_event_t *) event;
-				if (sse->state == XCB_SCREENSAVER_STATE_ON) {
-				    // screensave on, stop updates
-				    delay = -1;
-				} else if (delay == -1) {
-				    // screensave off, resume updates
-				    delay = Rate;
-				    Timeout();	// show latest info
-				}
-				break;
-			    }
+#ifdef PRECOMPILED_ATLAS
+    if (!Atlas) {			// shared by all windows
+	Atlas = AtlasCreate();
+    }
 #endif
-			    break;
-		    }
+    if (HeadlessName) {			// no server, frame is the output
+	if ((!Atlas
+		&& !(Atlas = XcbXpm2Image(NULL, 0, NULL, 24, 0UL, data, NULL)))
+	    || !(Dock->Frame = HeadlessImageCreate(64, 64))) {
+	    fprintf(stderr, "Can't create headless frame buffer\n");
+	    abort();
+	}
+	memset(Dock->Frame->data, 0, Dock->Frame->size);
+	return 0;
+    }
+    if (!Atlas) {			// shared by all windows
+	Atlas =
+	    XcbXpm2Image(Connection, Screen->default_colormap, TrueColor,
+	    Screen->root_depth, 0UL, data, NULL);
+	if (!Atlas) {
+	    return -1;
+	}
+	// frame composition copies whole pixels
+	if (Atlas->format != XCB_IMAGE_FORMAT_Z_PIXMAP || Atlas->bpp < 8) {
+	    xcb_image_destroy(Atlas);
+	    Atlas = NULL;
+	    return -1;
+	}
+    }
+    Dock->Frame =
+	xcb_image_create_native(Connection, 64, 64, XCB_IMAGE_FORMAT_Z_PIXMAP,
+	Screen->root_depth, NULL, 0L, NULL);
+    if (!Dock->Frame) {
+	return -1;
+    }
+#ifdef MIT_SHM
+    //
+    //	Try to move the frame buffer into shared memory.
+    //
+    if (xcb_get_extension_data(Connection, &xcb_shm_id)
+	&& xcb_get_extension_data(Connection, &xcb_shm_id)->present) {
+	xcb_generic_error_t *error;
 
-		    free(event);
-		} else {
-		    // No event, can happen, but we must check for close
-		    if (xcb_connection_has_error(Connection)) {
-			return;
+	Dock->FrameShm.shmid =
+	    shmget(IPC_PRIVATE, Dock->Frame->size, IPC_CREAT | 0600);
+	if (Dock->FrameShm.shmid != (uint32_t) - 1) {
+	    Dock->FrameShm.shmaddr = shmat(Dock->FrameShm.shmid, NULL, 0);
+	    if (Dock->FrameShm.shmaddr != (void *)-1) {
+		Dock->FrameShm.shmseg = xcb_generate_id(Connection);
+		// fails f.e. with remote X11 server
+		error =
+		    xcb_request_check(Connection,
+		    xcb_shm_attach_checked(Connection, Dock->FrameShm.shmseg,
+			Dock->FrameShm.shmid, 0));
+		if (!error) {
+		    image =
+			xcb_image_create_native(Connection, 64, 64,
+			XCB_IMAGE_FORMAT_Z_PIXMAP, Screen->root_depth, NULL,
+			Dock->Frame->size, Dock->FrameShm.shmaddr);
+		    if (image) {
+			xcb_image_destroy(Dock->Frame);
+			Dock->Frame = image;
+			ShmCompletionEventId =
+			    xcb_get_extension_data(Connection,
+			    &xcb_shm_id)->first_event + XCB_SHM_COMPLETION;
+		    } else {
+			xcb_shm_detach(Connection, Dock->FrameShm.shmseg);
 		    }
 		}
+		free(error);
+		if (Dock->Frame->data != Dock->FrameShm.shmaddr) {
+		    shmdt(Dock->FrameShm.shmaddr);
+		    Dock->FrameShm.shmaddr = NULL;
+		}
+	    } else {
+		Dock->FrameShm.shmaddr = NULL;
 	    }
-	} else {
-	    Timeout();
+	    // segment is destroyed after last detach
+	    shmctl(Dock->FrameShm.shmid, IPC_RMID, NULL);
 	}
     }
+    if (Verbose) {
+	printf("frame buffer %s\n",
+	    Dock->FrameShm.shmaddr ? "in shared memory" :
+	    "send with put image");
+    }
+#else
+    (void)image;
+#endif
+
+    return 0;
 }
 
 /**
-**	Init
+**	Add an area to the damaged area of the frame.
 **
-**	@param argc	number of arguments
-**	@param argv	arguments vector
+**	@param x	x pixel position
+**	@param y	y pixel position
+**	@param w	width of area
+**	@param h	height of area
 */
-int Init(int argc, char *const argv[])
+static void Damage(int x, int y, int w, int h)
 {
-    const char *display_name;
-    xcb_connection_t *connection;
-    xcb_screen_iterator_t iter;
-    int screen_nr;
-    xcb_screen_t *screen;
-    xcb_gcontext_t normal;
-    uint32_t mask;
-    uint32_t values[3];
-    xcb_pixmap_t pixmap;
-    xcb_window_t window;
-    xcb_size_hints_t size_hints;
-    xcb_icccm_wm_hints_t wm_hints;
-    int i;
-    int n;
-    char *s;
-
-    display_name = getenv("DISPLAY");
+    if (Dock->DamageX1 >= Dock->DamageX2) {		// empty
+	Dock->DamageX1 = x;
+	Dock->DamageY1 = y;
+	Dock->DamageX2 = x + w;
+	Dock->DamageY2 = y + h;
+	return;
+    }
+    if (x < Dock->DamageX1) {
+	Dock->DamageX1 = x;
+    }
+    if (y < Dock->DamageY1) {
+	Dock->DamageY1 = y;
+    }
+    if (x + w > Dock->DamageX2) {
+	Dock->DamageX2 = x + w;
+    }
+    if (y + h > Dock->DamageY2) {
+	Dock->DamageY2 = y + h;
+    }
+}
 
-    //	Open the connection to the X server.
-    //	use the DISPLAY environment variable as the default display name
-    connection = xcb_connect(NULL, &screen_nr);
-    if (!connection || xcb_connection_has_error(connection)) {
-	fprintf(stderr, "Can't connect to X11 server on %s\n", display_name);
-	return -1;
+/**
+**	Wait until the server has read the shared frame buffer.
+*/
+static inline void FrameSync(void)
+{
+#ifdef MIT_SHM
+    if (Dock->ShmBusy) {
+	// server must be finished with the last frame, round trip
+	free(xcb_get_input_focus_reply(Connection,
+		xcb_get_input_focus(Connection), NULL));
+	Dock->ShmBusy = 0;
     }
-    //	Get the requested screen number
-    iter = xcb_setup_roots_iterator(xcb_get_setup(connection));
-    for (i = 0; i < screen_nr; ++i) {
-	xcb_screen_next(&iter);
+#endif
+}
+
+/**
+**	Copy an area of the glyph atlas into the frame.
+**
+**	@param sx	source x pixel position in the glyph atlas
+**	@param sy	source y pixel position in the glyph atlas
+**	@param dx	destination x pixel position
+**	@param dy	destination y pixel position
+**	@param w	width of area
+**	@param h	height of area
+**
+**	Without client side frame buffer, the area is copied on the server.
+*/
+void Blit(int sx, int sy, int dx, int dy, int w, int h)
+{
+    int bpp;
+    const uint8_t *src;
+    uint8_t *dst;
+
+    if (!Dock->Frame) {
+	xcb_copy_area(Connection, Image, Dock->Pixmap, NormalGC, sx, sy, dx,
+	    dy, w, h);
+	Damage(dx, dy, w, h);
+	return;
+    }
+    FrameSync();
+    // clip to atlas and frame
+    if (sx + w > Atlas->width) {
+	w = Atlas->width - sx;
+    }
+    if (sy + h > Atlas->height) {
+	h = Atlas->height - sy;
+    }
+    if (dx + w > Dock->Frame->width) {
+	w = Dock->Frame->width - dx;
+    }
+    if (dy + h > Dock->Frame->height) {
+	h = Dock->Frame->height - dy;
+    }
+    if (w <= 0 || h <= 0) {
+	return;
     }
-    screen = iter.data;
 
-    //	Create normal graphic context
-    normal = xcb_generate_id(connection);
-    mask = XCB_GC_FOREGROUND | XCB_GC_BACKGROUND | XCB_GC_GRAPHICS_EXPOSURES;
-    values[0] = screen->white_pixel;
-    values[1] = screen->black_pixel;
-    values[2] = 0;
-    xcb_create_gc(connection, normal, screen->root, mask, values);
+    Damage(dx, dy, w, h);
+
+    bpp = Dock->Frame->bpp / 8;
+    src = Atlas->data + sy * Atlas->stride + sx * bpp;
+    dst = Dock->Frame->data + dy * Dock->Frame->stride + dx * bpp;
+    while (h--) {
+	memcpy(dst, src, w * bpp);
+	src += Atlas->stride;
+	dst += Dock->Frame->stride;
+    }
+}
+
+/**
+**	Fill an area of the frame with a tiled area of the glyph atlas.
+**
+**	@param sx	source x pixel position in the glyph atlas
+**	@param sy	source y pixel position in the glyph atlas
+**	@param sw	width of source area
+**	@param sh	height of source area
+**	@param x	destination x pixel position
+**	@param y	destination y pixel position
+**	@param w	width of destination area
+**	@param h	height of destination area
+*/
+void Fill(int sx, int sy, int sw, int sh, int x, int y, int w, int h)
+{
+    int dx;
+    int dy;
+
+    for (dy = 0; dy < h; dy += sh) {
+	for (dx = 0; dx < w; dx += sw) {
+	    Blit(sx, sy, x + dx, y + dy, w - dx < sw ? w - dx : sw,
+		h - dy < sh ? h - dy : sh);
+	}
+    }
+}
+
+/**
+**	Scroll an area of the frame one pixel to the left.
+**
+**	@param x	x pixel position
+**	@param y	y pixel position
+**	@param w	width of area
+**	@param h	height of area
+**
+**	The rightmost column isn't changed.
+*/
+void Scroll(int x, int y, int w, int h)
+{
+    int bpp;
+    uint8_t *dst;
+
+    Damage(x, y, w, h);
+    if (!Dock->Frame) {
+	xcb_copy_area(Connection, Dock->Pixmap, Dock->Pixmap, NormalGC, x + 1,
+	    y, x, y, w - 1, h);
+	return;
+    }
+    FrameSync();
+
+    bpp = Dock->Frame->bpp / 8;
+    dst = Dock->Frame->data + y * Dock->Frame->stride + x * bpp;
+    while (h--) {
+	memmove(dst, dst + bpp, (w - 1) * bpp);
+	dst += Dock->Frame->stride;
+    }
+}
+
+/**
+**	Write the headless frame as binary PPM.
+**
+**	The file name may contain one %d (f.e. frame%04d.ppm), which is
+**	replaced by the update number, otherwise the file is overwritten.
+**	Further windows get their number before the suffix (frame-1.ppm).
+**	The frame is written to a temporary file and renamed, readers never
+**	see a partial frame.
+*/
+static void HeadlessWrite(void)
+{
+    char name[PATH_MAX];
+    char tmp[PATH_MAX + 8];
+    uint8_t ppm[16 + 64 * 64 * 3];
+    uint8_t *dst;
+    int n;
+    int x;
+    int y;
+    int fd;
+
+    // HeadlessName is checked in main, only a single %d is allowed
+    snprintf(name, sizeof(name), HeadlessName, (int)Ticks);
+    if (Dock != Dockapps) {		// other windows: frame-1.ppm, ...
+	const char *suffix;
+
+	suffix = strrchr(name, '.');
+	if (!suffix || strchr(suffix, '/')) {
+	    suffix = name + strlen(name);
+	}
+	snprintf(tmp, sizeof(tmp), "%.*s-%d%s", (int)(suffix - name), name,
+	    (int)(Dock - Dockapps), suffix);
+	memcpy(name, tmp, sizeof(name));
+	name[sizeof(name) - 1] = '\0';
+    }
+    snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+
+    n = sprintf((char *)ppm, "P6\n64 64\n255\n");
+    dst = ppm + n;
+    for (y = 0; y < 64; ++y) {
+	const uint32_t *src;
+
+	src = (const uint32_t *)(Dock->Frame->data + y * Dock->Frame->stride);
+	for (x = 0; x < 64; ++x) {
+	    uint32_t pixel;
+
+	    // outside of the window shape is black
+	    pixel = Dock->HeadlessShape[y] >> x & 1 ? src[x] : 0;
+	    *dst++ = pixel >> 16;
+	    *dst++ = pixel >> 8;
+	    *dst++ = pixel;
+	}
+    }
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+	return;
+    }
+    n = write(fd, ppm, dst - ppm) != dst - ppm;
+    close(fd);
+    if (n || rename(tmp, name)) {
+	fprintf(stderr, "Can't write frame '%s'\n", name);
+	unlink(tmp);
+    }
+}
+
+/**
+**	Send the damaged area of the composed frame to our background pixmap.
+**
+**	@returns false if nothing was damaged and nothing was send.
+*/
+int FramePut(void)
+{
+    int x;
+    int y;
+    int w;
+    int h;
+
+    if (Dock->DamageX1 >= Dock->DamageX2) {		// nothing changed
+	return 0;
+    }
+    x = Dock->DamageX1;
+    y = Dock->DamageY1;
+    w = Dock->DamageX2 - Dock->DamageX1;
+    h = Dock->DamageY2 - Dock->DamageY1;
+    Dock->DamageX1 = Dock->DamageX2 = 0;
+
+    if (HeadlessName) {			// benchmark writes only last frame
+	if (!BenchTicks) {
+	    HeadlessWrite();
+	}
+	return 1;
+    }
+    if (Dock->Frame) {
+#ifdef MIT_SHM
+	if (Dock->FrameShm.shmaddr) {
+	    xcb_shm_put_image(Connection, Dock->Pixmap, NormalGC,
+		Dock->Frame->width, Dock->Frame->height, x, y, w, h, x, y,
+		Dock->Frame->depth,
+		XCB_IMAGE_FORMAT_Z_PIXMAP, 1, Dock->FrameShm.shmseg, 0);
+	    Dock->ShmBusy = 1;
+	} else
+#endif
+	{
+	    // send only the damaged rows
+	    xcb_put_image(Connection, XCB_IMAGE_FORMAT_Z_PIXMAP, Dock->Pixmap,
+		NormalGC, Dock->Frame->width, h, 0, y, 0, Dock->Frame->depth,
+		h * Dock->Frame->stride,
+		Dock->Frame->data + y * Dock->Frame->stride);
+	}
+    }
+    xcb_clear_area(Connection, 0, Dock->Window, x, y, w, h);
+
+    return 1;
+}
+
+/**
+**	Free the client side frame buffer of the current window.
+*/
+void FrameExit(void)
+{
+    if (Dock->Frame) {
+#ifdef MIT_SHM
+	if (Dock->FrameShm.shmaddr) {
+	    xcb_shm_detach(Connection, Dock->FrameShm.shmseg);
+	    xcb_image_destroy(Dock->Frame);
+	    shmdt(Dock->FrameShm.shmaddr);
+	    Dock->FrameShm.shmaddr = NULL;
+	} else
+#endif
+	    xcb_image_destroy(Dock->Frame);
+	Dock->Frame = NULL;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////
+
+/**
+**	Arm the update timer.
+**
+**	@param rate	update rate in ms, 0 disarms the timer
+**	@param now	first update immediately, otherwise after rate ms
+**
+**	Only the request is handed to the sampler thread, which owns the
+**	schedule (see TimerTimeout).
+*/
+static void TimerArm(int rate, int now)
+{
+    uint64_t one;
+    int n;
+
+    one = 1;
+    __atomic_store_n(&TimerRequest, rate > 0 ? rate * 2LL + !!now : 0,
+	__ATOMIC_RELEASE);
+    // wake the sampler, a still pending wakeup is as good
+    n = TimerFD >= 0 ? write(TimerFD, &one, sizeof(one)) : 0;
+    (void)n;
+}
+
+/**
+**	Follow the update rate chosen by the sampler thread.
+**
+**	Only the X11 thread arms the timer, so a sample triggered by an
+**	alarm didn't restart the updates stopped by the screensaver.
+*/
+static void RateUpdate(void)
+{
+    int rate;
+
+    rate = __atomic_load_n(&RateNext, __ATOMIC_RELAXED);
+    if (rate != Rate) {
+	Rate = rate;
+	TimerArm(Rate, 0);
+	if (Verbose) {
+	    printf("update rate %d ms\n", Rate);
+	    fflush(stdout);
+	}
+    }
+}
+
+/**
+**	Set or clear a reason to suspend the updates.
+**
+**	@param reason	SUSPEND_SCREENSAVER, SUSPEND_HIDDEN or SUSPEND_DPMS
+**	@param on	true the reason applies, false it is gone
+**
+**	While the output can't be seen, the timer is stopped, the sampler
+**	thread sleeps and no frame is rendered.  With -x the sampler keeps
+**	running for the readers of the export, only rendering is stopped.
+**	On resume one catch-up frame is sampled and drawn immediately.
+*/
+static void SuspendSet(int reason, int on)
+{
+    int old;
+
+    old = Suspended;
+    if (on) {
+	Suspended |= reason;
+    } else {
+	Suspended &= ~reason;
+    }
+    if (!old && Suspended) {
+	++SuspendCount;
+	SuspendStart = NowNs();
+	if (!ExportName) {
+	    TimerArm(0, 0);
+	}
+	if (Verbose) {
+	    printf("updates suspended (%d)\n", Suspended);
+	    fflush(stdout);
+	}
+    } else if (old && !Suspended) {
+	SuspendTime += NowNs() - SuspendStart;
+	// sample now, show latest info
+	TimerArm(Rate, 1);
+	if (Verbose) {
+	    printf("updates resumed after %.3f s\n",
+		(NowNs() - SuspendStart) / 1e9);
+	    fflush(stdout);
+	}
+    }
+}
+
+/**
+**	Track the visibility of a dockapp window.
+**
+**	@param window	window of the map, unmap or visibility event
+**	@param unmapped	window is unmapped, -1 unchanged
+**	@param obscured	window is fully obscured, -1 unchanged
+**
+**	Hidden windows aren't drawn, if all windows are hidden the updates
+**	are suspended.  A window shown again gets a catch-up frame.
+*/
+static void DockappVisibility(xcb_window_t window, int unmapped,
+    int obscured)
+{
+    int hidden;
+    int shown;
+    int i;
+
+    hidden = 1;
+    shown = 0;
+    for (i = 0; i < DockappN; ++i) {
+	Dockapp *dockapp;
+
+	dockapp = Dockapps + i;
+	if (dockapp->Window == window) {
+	    shown = dockapp->Unmapped || dockapp->Obscured;
+	    if (unmapped >= 0) {
+		dockapp->Unmapped = unmapped;
+	    }
+	    if (obscured >= 0) {
+		dockapp->Obscured = obscured;
+	    }
+	    shown &= !dockapp->Unmapped && !dockapp->Obscured;
+	    if (shown) {		// missed updates, redraw everything
+		dockapp->GraphDirty = 1;
+		dockapp->CellN = 0;
+	    }
+	}
+	hidden &= dockapp->Unmapped || dockapp->Obscured;
+    }
+    if (shown && !Suspended) {		// others visible, draw this now
+	TimerArm(Rate, 1);
+    }
+    SuspendSet(SUSPEND_HIDDEN, hidden);
+}
+
+#ifdef DPMS
+
+/**
+**	Poll the DPMS power level of the monitor.
+**
+**	DPMS has no events, the state is queried every DPMS_CHECK ms.  The
+**	request is sent without waiting, the reply is picked up when it
+**	arrived, the event loop didn't block on a round trip.
+**
+**	@returns poll timeout in ms until the next query.
+*/
+static int DpmsPoll(void)
+{
+    uint64_t now;
+
+    if (DpmsPending) {
+	xcb_dpms_info_reply_t *reply;
+	xcb_generic_error_t *error;
+
+	reply = NULL;
+	error = NULL;
+	if (!xcb_poll_for_reply(Connection, DpmsCookie.sequence,
+		(void **)&reply, &error)) {
+	    return DPMS_CHECK;		// the reply wakes the event loop
+	}
+	DpmsPending = 0;
+	if (reply) {
+	    // standby, suspend and off: nobody can see us
+	    SuspendSet(SUSPEND_DPMS, reply->state
+		&& reply->power_level != XCB_DPMS_DPMS_MODE_ON);
+	    free(reply);
+	}
+	free(error);
+    }
+    now = NowNs();
+    if (now < DpmsNext) {
+	return (DpmsNext - now) / 1000000 + 1;
+    }
+    DpmsCookie = xcb_dpms_info(Connection);
+    xcb_flush(Connection);
+    DpmsPending = 1;
+    DpmsNext = now + DPMS_CHECK * 1000000ULL;
+    return DPMS_CHECK;
+}
+
+#endif
+
+/**
+**	Setup the signalfd for SIGUSR1, which dumps the metrics, and for
+**	SIGINT and SIGTERM, which end the event loop for a clean exit.
+**
+**	Must be called before any thread is created, the signals are blocked
+**	in all threads and only read from the signalfd by the event loop.
+**	The benchmark has no event loop, SIGINT and SIGTERM stay unblocked
+**	and end it at once.
+*/
+static void SignalSetup(void)
+{
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    if (BenchTicks <= 0) {
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+    }
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    SignalFD = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+/**
+**	Loop
+*/
+void Loop(void)
+{
+    struct pollfd fds[3];
+    xcb_generic_event_t *event;
+    uint64_t samples;
+    int n;
+    int timeout;
+
+    fds[0].fd = xcb_get_file_descriptor(Connection);
+    fds[0].events = POLLIN | POLLPRI;
+    // the sampler thread runs the update timer
+    fds[1].fd = SampleFD;
+    fds[1].events = POLLIN;
+    fds[2].fd = SignalFD;		// ignored, if -1
+    fds[2].events = POLLIN;
+
+    for (;;) {
+	timeout = -1;
+#ifdef DPMS
+	if (UseDpms) {
+	    timeout = DpmsPoll();
+	}
+#endif
+	n = poll(fds, 3, timeout);
+	if (n < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    break;
+	}
+	if (fds[1].revents & POLLIN) {
+	    // new snapshot from the sampler thread
+	    if (read(SampleFD, &samples, sizeof(samples)) == sizeof(samples)
+		&& !Suspended) {
+		RateUpdate();
+		Timeout();
+	    }
+	    if (__atomic_load_n(&ReplayDone, __ATOMIC_ACQUIRE)) {
+		return;			// end of the replay: clean exit
+	    }
+	}
+	if (fds[2].revents & POLLIN) {
+	    struct signalfd_siginfo info;
+
+	    if (read(SignalFD, &info, sizeof(info)) == sizeof(info)) {
+		if (info.ssi_signo != SIGUSR1) {
+		    return;		// SIGINT, SIGTERM: clean exit
+		}
+		MetricsDump();
+	    }
+	}
+	if (fds[0].revents & (POLLIN | POLLPRI | POLLHUP | POLLERR)) {
+	    while ((event = xcb_poll_for_event(Connection))) {
+
+		switch (event->response_type & XCB_EVENT_RESPONSE_TYPE_MASK) {
+		    case XCB_EXPOSE:
+			// background pixmap no need to redraw
+#if 0
+			// collapse multi expose
+			if (!((xcb_expose_event_t *) event)->count) {
+			    xcb_clear_area(Connection, 0, Dock->Window, 0, 0,
+				64, 64);
+			    // flush the request
+			    xcb_flush(Connection);
+			}
+#endif
+			break;
+		    case XCB_VISIBILITY_NOTIFY:
+			DockappVisibility(((xcb_visibility_notify_event_t *)
+				event)->window, -1,
+			    ((xcb_visibility_notify_event_t *) event)->state
+			    == XCB_VISIBILITY_FULLY_OBSCURED);
+			break;
+		    case XCB_MAP_NOTIFY:
+			DockappVisibility(((xcb_map_notify_event_t *)
+				event)->window, 0, -1);
+			break;
+		    case XCB_UNMAP_NOTIFY:
+			DockappVisibility(((xcb_unmap_notify_event_t *)
+				event)->window, 1, -1);
+			break;
+		    case XCB_DESTROY_NOTIFY:
+			// window destroyed, exit application
+			free(event);
+			return;
+		    case 0:
+			// error_code
+			// printf("error %x\n", event->response_type);
+			break;
+		    default:
+			// Unknown event type, ignore it
+			// printf("unknown %x\n", event->response_type);
+#ifdef MIT_SHM
+			if (ShmCompletionEventId
+			    && XCB_EVENT_RESPONSE_TYPE(event) ==
+			    ShmCompletionEventId) {
+			    xcb_shm_completion_event_t *sce;
+			    int i;
+
+			    // server has read the frame buffer
+			    sce = (xcb_shm_completion_event_t *) event;
+			    for (i = 0; i < DockappN; ++i) {
+				if (Dockapps[i].Pixmap == sce->drawable) {
+				    Dockapps[i].ShmBusy = 0;
+				}
+			    }
+			    break;
+			}
+#endif
+#ifdef SCREENSAVER
+			if (XCB_EVENT_RESPONSE_TYPE(event) ==
+			    ScreenSaverEventId) {
+			    xcb_screensaver_notify_event_t *sse;
+
+			    // screensave on stops, off resumes updates
+			    sse = (xcb_screensaver_notify_event_t *) event;
+			    SuspendSet(SUSPEND_SCREENSAVER,
+				sse->state == XCB_SCREENSAVER_STATE_ON);
+			    break;
+			}
+#endif
+			break;
+		}
+
+		free(event);
+	    }
+	    // No event, can happen, but we must check for close
+	    if (xcb_connection_has_error(Connection)) {
+		break;
+	    }
+	}
+    }
+}
+
+/**
+**	Create the window of a dockapp.
+**
+**	@param connection	XCB connection to X11 server
+**	@param screen		our screen
+**	@param dockapp		dockapp, gets the window and background pixmap
+**	@param argc		number of arguments
+**	@param argv		arguments vector
+*/
+static void DockappCreate(xcb_connection_t * connection,
+    xcb_screen_t * screen, Dockapp * dockapp, int argc, char *const argv[])
+{
+    uint32_t mask;
+    uint32_t values[2];
+    xcb_pixmap_t pixmap;
+    xcb_window_t window;
+    xcb_size_hints_t size_hints;
+    xcb_icccm_wm_hints_t wm_hints;
+    int i;
+    int n;
+    char *s;
 
     //	Pixmap
     //		We use a background pixmap, nice window move and expose.
@@ -496,6 +1618,10 @@ int Init(int argc, char *const argv[])
     mask = XCB_CW_BACK_PIXMAP | XCB_CW_EVENT_MASK;
     values[0] = pixmap;
     values[1] = XCB_EVENT_MASK_EXPOSURE;
+    if (UseSleep) {			// map, unmap and obscured windows
+	values[1] |=
+	    XCB_EVENT_MASK_VISIBILITY_CHANGE | XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+    }
 
     xcb_create_window(connection,	// Connection
 	XCB_COPY_FROM_PARENT,		// depth (same as root)
@@ -546,27 +1672,90 @@ int Init(int argc, char *const argv[])
     xcb_change_property(connection, XCB_PROP_MODE_REPLACE, window,
 	XCB_ATOM_WM_COMMAND, XCB_ATOM_STRING, 8, n, s);
 
-#ifdef SCREENSAVER
-    //
-    //	Prepare screensaver notify.
-    //
-    if (UseSleep) {
-	const xcb_query_extension_reply_t *reply_screensaver;
+    dockapp->Window = window;
+    dockapp->Pixmap = pixmap;
+}
 
-	reply_screensaver =
-	    xcb_get_extension_data(connection, &xcb_screensaver_id);
-	if (reply_screensaver) {
-	    ScreenSaverEventId =
+/**
+**	Init
+**
+**	@param argc	number of arguments
+**	@param argv	arguments vector
+*/
+int Init(int argc, char *const argv[])
+{
+    const char *display_name;
+    xcb_connection_t *connection;
+    xcb_screen_iterator_t iter;
+    int screen_nr;
+    xcb_screen_t *screen;
+    xcb_gcontext_t normal;
+    uint32_t mask;
+    uint32_t values[3];
+    int i;
+
+    display_name = getenv("DISPLAY");
+
+    //	Open the connection to the X server.
+    //	use the DISPLAY environment variable as the default display name
+    connection = xcb_connect(NULL, &screen_nr);
+    if (!connection || xcb_connection_has_error(connection)) {
+	fprintf(stderr, "Can't connect to X11 server on %s\n", display_name);
+	return -1;
+    }
+    //	Get the requested screen number
+    iter = xcb_setup_roots_iterator(xcb_get_setup(connection));
+    for (i = 0; i < screen_nr; ++i) {
+	xcb_screen_next(&iter);
+    }
+    screen = iter.data;
+
+    //	Create normal graphic context
+    normal = xcb_generate_id(connection);
+    mask = XCB_GC_FOREGROUND | XCB_GC_BACKGROUND | XCB_GC_GRAPHICS_EXPOSURES;
+    values[0] = screen->white_pixel;
+    values[1] = screen->black_pixel;
+    values[2] = 0;
+    xcb_create_gc(connection, normal, screen->root, mask, values);
+
+    for (i = 0; i < DockappN; ++i) {
+	DockappCreate(connection, screen, Dockapps + i, argc, argv);
+    }
+
+#ifdef SCREENSAVER
+    //
+    //	Prepare screensaver notify.
+    //
+    if (UseSleep) {
+	const xcb_query_extension_reply_t *reply_screensaver;
+
+	reply_screensaver =
+	    xcb_get_extension_data(connection, &xcb_screensaver_id);
+	if (reply_screensaver) {
+	    ScreenSaverEventId =
 		reply_screensaver->first_event + XCB_SCREENSAVER_NOTIFY;
 
-	    xcb_screensaver_select_input(connection, window,
+	    xcb_screensaver_select_input(connection, Dockapps[0].Window,
 		XCB_SCREENSAVER_EVENT_NOTIFY_MASK);
 	}
     }
 #endif
+#ifdef DPMS
+    //
+    //	Prepare DPMS power level queries.
+    //
+    if (UseSleep) {
+	const xcb_query_extension_reply_t *reply_dpms;
+
+	reply_dpms = xcb_get_extension_data(connection, &xcb_dpms_id);
+	UseDpms = reply_dpms && reply_dpms->present;
+    }
+#endif
 
-    //	Map the window on the screen
-    xcb_map_window(connection, window);
+    //	Map the windows on the screen
+    for (i = 0; i < DockappN; ++i) {
+	xcb_map_window(connection, Dockapps[i].Window);
+    }
 
     //	Make sure commands are sent
     xcb_flush(connection);
@@ -574,9 +1763,8 @@ int Init(int argc, char *const argv[])
     //	Move local vars for global use
     Connection = connection;
     Screen = screen;
-    Window = window;
     NormalGC = normal;
-    Pixmap = pixmap;
+    TrueColor = TrueColorVisual(screen);
 
     return 0;
 }
@@ -586,11 +1774,30 @@ int Init(int argc, char *const argv[])
 */
 void Exit(void)
 {
-    xcb_destroy_window(Connection, Window);
-    Window = 0;
-
-    xcb_free_pixmap(Connection, Pixmap);
+    int i;
 
+    if (Verbose) {
+	printf("%u of %u updates without X11 requests\n", SkippedTicks,
+	    Ticks);
+	printf("%u missed updates coalesced\n", MissedTicks);
+	MetricsDump();
+    }
+    for (i = 0; i < DockappN; ++i) {
+	Dock = Dockapps + i;
+	if (Connection) {
+	    xcb_destroy_window(Connection, Dock->Window);
+	    Dock->Window = 0;
+	    xcb_free_pixmap(Connection, Dock->Pixmap);
+	}
+	FrameExit();
+    }
+    if (Atlas) {
+	xcb_image_destroy(Atlas);
+	Atlas = NULL;
+    }
+    if (!Connection) {			// headless
+	return;
+    }
     if (Image) {
 	xcb_free_pixmap(Connection, Image);
     }
@@ -603,6 +1810,37 @@ void Exit(void)
 //	App Stuff
 ////////////////////////////////////////////////////////////////////////////
 
+/**
+**	Check if a display cell must be redrawn.
+**
+**	@param	x	x pixel position
+**	@param	y	y pixel position
+**	@param	value	value to draw (includes the glyph style)
+**
+**	@returns true if the value has changed since the last draw.
+*/
+static int CellChanged(int x, int y, unsigned value)
+{
+    int i;
+
+    for (i = 0; i < Dock->CellN; ++i) {
+	if (Dock->Cells[i].X == x && Dock->Cells[i].Y == y) {
+	    if (Dock->Cells[i].Value == value) {
+		return 0;
+	    }
+	    Dock->Cells[i].Value = value;
+	    return 1;
+	}
+    }
+    if (Dock->CellN < (int)(sizeof(Dock->Cells) / sizeof(*Dock->Cells))) {
+	Dock->Cells[Dock->CellN].X = x;
+	Dock->Cells[Dock->CellN].Y = y;
+	Dock->Cells[Dock->CellN].Value = value;
+	++Dock->CellN;
+    }
+    return 1;
+}
+
 /**
 **	Draw a string at given cordinates.
 **
@@ -621,16 +1859,13 @@ void DrawString(const char *s, int x, int y)
     while (*s) {
 	c = toupper(*s);
 	if (c == ' ') {
-	    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 0, 65, dx, y, 6,
-		7);
+	    Blit(0, 65, dx, y, 6, 7);
 	} else if ('A' <= c && c <= 'Z') {	// is a letter
 	    c -= 'A';
-	    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 1 + c * 6, 75,
-		dx, y, 6, 7);
+	    Blit(1 + c * 6, 75, dx, y, 6, 7);
 	} else {			// is a number or symbol
 	    c -= '\'';
-	    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 1 + c * 6, 65,
-		dx, y, 6, 7);
+	    Blit(1 + c * 6, 65, dx, y, 6, 7);
 	}
 	dx += 6;
 	++s;
@@ -668,421 +1903,4104 @@ void DrawRedSmallNumber(unsigned num, int x, int y)
     int n10;
     int n1;
 
+    if (!CellChanged(x, y, num | 1U << 31)) {
+	return;
+    }
+
+    n1 = num % 10;
+    n10 = (num / 10) % 10;
+    n100 = (num / 100) % 10;
+    n1000 = (num / 1000) % 10;
+
+    if (n1000) {
+	Blit(n1000 * 6, 36, x, y, 6, 7);
+    } else {
+	Blit(2, 2, x, y, 6, 7);
+    }
+    x += 6;
+
+    if (n1000 || n100) {
+	Blit(n100 * 6, 36, x, y, 6, 7);
+	x += 6;
+    }
+    if (n1000 || n100 || n10) {
+	Blit(n10 * 6, 36, x, y, 6, 7);
+	x += 6;
+    }
+    Blit(n1 * 6, 36, x, y, 6, 7);
+}
+
+/**
+**	Draw a number at given cordinates with small font.
+**
+**	@param	num	unsigned number
+**	@param	x	x pixel position
+**	@param	y	y pixel position
+*/
+void DrawSmallNumber(unsigned num, int x, int y)
+{
+    int n1000;
+    int n100;
+    int n10;
+    int n1;
+
+    if (!CellChanged(x, y, num)) {
+	return;
+    }
+
     n1 = num % 10;
     n10 = (num / 10) % 10;
     n100 = (num / 100) % 10;
     n1000 = (num / 1000) % 10;
 
     if (n1000) {
-	xcb_copy_area(Connection, Image, Pixmap, NormalGC, n1000 * 6, 36, x, y,
-	    6, 7);
+	Blit(n1000 * 6, 50, x, y, 6, 7);
     } else {
-	xcb_copy_area(Connection, Image, Pixmap, NormalGC, 2, 2, x, y, 6, 7);
+	Blit(2, 2, x, y, 6, 7);
     }
     x += 6;
 
     if (n1000 || n100) {
-	xcb_copy_area(Connection, Image, Pixmap, NormalGC, n100 * 6, 36, x, y,
-	    6, 7);
+	Blit(n100 * 6, 50, x, y, 6, 7);
 	x += 6;
     }
     if (n1000 || n100 || n10) {
-	xcb_copy_area(Connection, Image, Pixmap, NormalGC, n10 * 6, 36, x, y,
-	    6, 7);
+	Blit(n10 * 6, 50, x, y, 6, 7);
 	x += 6;
     }
-    xcb_copy_area(Connection, Image, Pixmap, NormalGC, n1 * 6, 36, x, y, 6, 7);
+    Blit(n1 * 6, 50, x, y, 6, 7);
+}
+
+/**
+**	Draw a number at given cordinates with LCD font.
+**
+**	@param	num	unsigned number
+**	@param	x	x pixel position
+**	@param	y	y pixel position
+*/
+void DrawLcdNumber(unsigned num, int x, int y)
+{
+    int n100;
+    int n10;
+    int n1;
+
+    if (num > 999) {
+	num = 999;
+    }
+    if (!CellChanged(x, y, num)) {
+	return;
+    }
+
+    n1 = num % 10;
+    n10 = (num / 10) % 10;
+    n100 = (num / 100) % 10;
+
+    if (n100) {
+	Blit(n100 * 5, 57, x, y, 5, 7);
+    } else {
+	Blit(2, 24, x, y, 5, 7);
+    }
+    x += 6;
+    if (n100 || n10) {
+	Blit(n10 * 5, 57, x, y, 5, 7);
+    } else {
+	Blit(2, 24, x, y, 5, 7);
+    }
+    x += 7;
+    Blit(n1 * 5, 57, x, y, 5, 7);
+}
+
+// ------------------------------------------------------------------------- //
+
+/**
+**	Sensor handle.
+**
+**	Every sensor file is opened only once and is re-read with pread(2),
+**	this saves the open/close and the path lookup on every update.
+*/
+typedef struct _sensor_
+{
+    char *Name;				///< file name of the sensor
+    int FD;				///< cached file descriptor or -1
+    int Value;				///< last sampled value
+    char Virtual;			///< value isn't read from a file
+    char Temperature;			///< temperature, drives adaptive rate
+    int Last;				///< value at the last rate adaption
+#ifdef IO_URING
+    char Buf[32];			///< io_uring read buffer
+#endif
+} Sensor;
+
+static Sensor *Sensors;			///< table of all sensor handles
+static int SensorN;			///< number of sensor handles
+    /// sensor names and stdout, hotplug rebuild against metrics dump
+static pthread_mutex_t SensorNameLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int SlotTemps[SLOT_MAX];		///< temperature of display slots
+static int SlotFreqs[SLOT_MAX];		///< frequency of display slots
+static char SlotTurbo[SLOT_MAX];	///< frequency of slot is turbo boost
+static int SlotZones[2];		///< thermal zones of display slots
+static int SlotCpu;			///< aggregate: number of hottest cpu
+
+#define HISTORY_SIZE 64			///< samples kept per sensor, power of 2
+
+static int *History;			///< history ring buffers of all sensors
+static unsigned HistoryHead;		///< ring index of the next sample
+static unsigned HistoryN;		///< number of samples in the rings
+
+#define GRAPH_X 2			///< graph x pixel position
+#define GRAPH_Y 14			///< graph y pixel position
+#define GRAPH_W 60			///< graph width
+#define GRAPH_H 48			///< graph height
+#define GRAPH_MIN 20000			///< temperature at graph bottom
+#define GRAPH_MAX 100000		///< temperature at graph top
+
+static int *CoreTemps;			///< temperatures of all cores
+static int *CoreFreqs;			///< frequencies of all cores
+static int CoreFreqN;			///< number of core frequencies
+static int ZoneSensors[ZONE_MAX];	///< thermal zone sensor handles
+static int ZoneFirst;			///< first zone of the displayed page
+static int ZonePages;			///< updates since last page of zones
+
+static unsigned SensorSyscalls;		///< number of sensor syscalls done
+static unsigned TickSyscalls;		///< sensor syscalls of last update
+
+static int *Values;			///< sampled values used for drawing
+
+/**
+**	Open a sysfs file or directory, relative to the sysfs root.
+**
+**	@param path	absolute path name (f.e. "/sys/class/hwmon")
+**	@param flags	open flags, O_CLOEXEC is added
+**
+**	@returns the file descriptor, -1 on failure.
+**
+**	With -R all paths are looked up below the given root directory,
+**	so synthetic trees can replace the live /sys.  The names of the
+**	sensors are unchanged.
+*/
+static int SysOpen(const char *path, int flags)
+{
+    if (SysRootFD < 0) {
+	return open(path, flags | O_CLOEXEC);
+    }
+    while (*path == '/') {
+	++path;
+    }
+    return openat(SysRootFD, path, flags | O_CLOEXEC);
+}
+
+/**
+**	Open a sysfs directory, relative to the sysfs root.
+**
+**	@param path	absolute path name of the directory
+**
+**	@returns the directory stream, NULL on failure.
+*/
+static DIR *SysOpenDir(const char *path)
+{
+    DIR *dir;
+    int fd;
+
+    if ((fd = SysOpen(path, O_RDONLY | O_DIRECTORY)) < 0) {
+	return NULL;
+    }
+    if (!(dir = fdopendir(fd))) {
+	close(fd);
+    }
+    return dir;
+}
+
+/**
+**	(Re-)open the file of a sensor.
+**
+**	@param sensor	sensor handle to open
+**
+**	@returns the file descriptor, -1 on failure.
+*/
+static int SensorOpen(Sensor * sensor)
+{
+    if (sensor->FD >= 0) {
+	++SensorSyscalls;
+	close(sensor->FD);
+    }
+    ++SensorSyscalls;
+    sensor->FD = SysOpen(sensor->Name, O_RDONLY);
+    return sensor->FD;
+}
+
+/**
+**	Append a new sensor to the sensor table.
+**
+**	@param name	unique name of the sensor
+**
+**	@returns the sensor handle, the sensor isn't opened.
+*/
+static int SensorNew(const char *name)
+{
+    Sensors = realloc(Sensors, (SensorN + 1) * sizeof(*Sensors));
+    if (!Sensors) {
+	fprintf(stderr, "out of memory\n");
+	abort();
+    }
+    Sensors[SensorN].Name = strdup(name);
+    Sensors[SensorN].FD = -1;
+    Sensors[SensorN].Value = -1;
+    Sensors[SensorN].Virtual = 0;
+    Sensors[SensorN].Temperature = 0;
+    Sensors[SensorN].Last = -1;
+
+    return SensorN++;
+}
+
+/**
+**	Find a sensor in the sensor table.
+**
+**	@param name	unique name of the sensor
+**
+**	@returns the sensor handle, -1 if not found.
+*/
+static int SensorFind(const char *name)
+{
+    int i;
+
+    for (i = 0; i < SensorN; ++i) {
+	if (!strcmp(Sensors[i].Name, name)) {
+	    return i;
+	}
+    }
+    return -1;
+}
+
+/**
+**	Add a sensor file to the sensor table.
+**
+**	@param name	name of file containing only the number
+**
+**	@returns the sensor handle used by ReadNumber().
+**
+**	The same file added twice, returns the same handle.
+*/
+static int SensorAdd(const char *name)
+{
+    int i;
+
+    if ((i = SensorFind(name)) < 0) {
+	i = SensorNew(name);
+	SensorOpen(Sensors + i);
+    }
+    return i;
+}
+
+/**
+**	Add a virtual sensor to the sensor table.
+**
+**	@param name	unique name of the sensor
+**
+**	@returns the sensor handle, the value is set by its backend.
+*/
+static int SensorAddVirtual(const char *name)
+{
+    int i;
+
+    if ((i = SensorFind(name)) < 0) {
+	i = SensorNew(name);
+	Sensors[i].Virtual = 1;
+    }
+    return i;
+}
+
+/**
+**	Rebind a sensor handle to another file.
+**
+**	@param handle	sensor handle
+**	@param name	new file name of the sensor
+*/
+static void SensorRebind(int handle, const char *name)
+{
+    Sensor *sensor;
+
+    sensor = Sensors + handle;
+    if (strcmp(sensor->Name, name)) {
+	free(sensor->Name);
+	sensor->Name = strdup(name);
+	SensorOpen(sensor);
+    }
+}
+
+// ------------------------------------------------------------------------- //
+
+/**
+**	Coretemp sensor of one core, found by the hwmon discovery.
+*/
+typedef struct _core_temp_
+{
+    int Package;			///< physical package id
+    int Core;				///< core id
+    char *Name;				///< file name of temperature input
+} CoreTemp;
+
+static char **CoreTempMap;		///< logical cpu -> temperature input
+static int CoreTempMapN;		///< number of entries in the map
+
+static int UeventFD = -1;		///< netlink uevent socket
+
+#define UEVENT_HOTPLUG 1		///< cpu or hwmon added or removed
+#define UEVENT_ALARM 2			///< hwmon or thermal zone changed
+
+static struct pollfd *Alarms;		///< sampler poll: timer, uevent, alarms
+static int AlarmN;			///< number of watched alarm files
+static unsigned AlarmCount;		///< number of alarm wakeups
+
+/**
+**	Read a short string from a file.  Only used for discovery.
+**
+**	@param file		file name
+**	@param[out] buf		buffer for the string, newline is removed
+**	@param size		size of buffer
+**
+**	@returns length of string, -1 if the file isn't readable.
+*/
+static int ReadString(const char *file, char *buf, size_t size)
+{
+    int fd;
+    int n;
+
+    if ((fd = SysOpen(file, O_RDONLY)) < 0) {
+	return -1;
+    }
+    n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0) {
+	return -1;
+    }
+    while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == ' ')) {
+	--n;
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+/**
+**	Scan one coretemp hwmon directory.
+**
+**	@param dir_name		hwmon directory
+**	@param[in,out] temps	found core sensors
+**	@param[in,out] n	number of found core sensors
+*/
+static void HwmonScan(const char *dir_name, CoreTemp ** temps, int *n)
+{
+    DIR *dir;
+    struct dirent *dp;
+    char file[1024];
+    char label[64];
+    int package;
+    int first;
+    int nr;
+    int id;
+    int i;
+
+    if (!(dir = SysOpenDir(dir_name))) {
+	return;
+    }
+    package = 0;
+    first = *n;
+    while ((dp = readdir(dir))) {
+	char dummy;
+
+	if (sscanf(dp->d_name, "temp%d_label%c", &nr, &dummy) != 1) {
+	    continue;
+	}
+	snprintf(file, sizeof(file), "%s/%s", dir_name, dp->d_name);
+	if (ReadString(file, label, sizeof(label)) <= 0) {
+	    continue;
+	}
+	if (sscanf(label, "Package id %d", &id) == 1) {
+	    package = id;
+	    continue;
+	}
+	if (sscanf(label, "Core %d", &id) != 1) {
+	    continue;
+	}
+	*temps = realloc(*temps, (*n + 1) * sizeof(**temps));
+	if (!*temps) {
+	    fprintf(stderr, "out of memory\n");
+	    abort();
+	}
+	snprintf(file, sizeof(file), "%s/temp%d_input", dir_name, nr);
+	(*temps)[*n].Core = id;
+	(*temps)[*n].Name = strdup(file);
+	++*n;
+    }
+    closedir(dir);
+    // the package label may come after the cores
+    for (i = first; i < *n; ++i) {
+	(*temps)[i].Package = package;
+    }
+}
+
+/**
+**	Get the attribute directory and the chip name of a hwmon device.
+**
+**	@param entry		hwmon device (f.e. "hwmon1")
+**	@param[out] dir		buffer for the attribute directory
+**	@param dir_size		size of directory buffer
+**	@param[out] name	buffer for the chip name (f.e. "coretemp")
+**	@param name_size	size of name buffer
+**
+**	@returns 0 on success, -1 if the device has no name.
+*/
+static int HwmonName(const char *entry, char *dir, size_t dir_size,
+    char *name, size_t name_size)
+{
+    // older kernels have the attributes in the device directory
+    snprintf(dir, dir_size, "/sys/class/hwmon/%s/name", entry);
+    if (ReadString(dir, name, name_size) > 0) {
+	snprintf(dir, dir_size, "/sys/class/hwmon/%s", entry);
+	return 0;
+    }
+    snprintf(dir, dir_size, "/sys/class/hwmon/%s/device/name", entry);
+    if (ReadString(dir, name, name_size) <= 0) {
+	return -1;
+    }
+    snprintf(dir, dir_size, "/sys/class/hwmon/%s/device", entry);
+    return 0;
+}
+
+/**
+**	Discover the coretemp sensors of all logical cpus.
+**
+**	Scans /sys/class/hwmon for coretemp drivers, matches the "Core N"
+**	labels through the cpu topology to logical cpus and builds the
+**	cached #CoreTempMap.  Only called at startup and on hotplug.
+*/
+static void HwmonDiscover(void)
+{
+    DIR *dir;
+    struct dirent *dp;
+    char file[512];
+    char buf[64];
+    CoreTemp *temps;
+    int n;
+    int i;
+    int cpu;
+    int package;
+    int core;
+
+    for (i = 0; i < CoreTempMapN; ++i) {
+	free(CoreTempMap[i]);
+    }
+    free(CoreTempMap);
+    CoreTempMap = NULL;
+    CoreTempMapN = 0;
+
+    //
+    //	Find all coretemp core sensors.
+    //
+    temps = NULL;
+    n = 0;
+    if ((dir = SysOpenDir("/sys/class/hwmon"))) {
+	while ((dp = readdir(dir))) {
+	    if (strncmp(dp->d_name, "hwmon", 5)) {
+		continue;
+	    }
+	    if (HwmonName(dp->d_name, file, sizeof(file), buf,
+		    sizeof(buf))) {
+		continue;
+	    }
+	    if (!strcmp(buf, "coretemp")) {
+		HwmonScan(file, &temps, &n);
+	    }
+	}
+	closedir(dir);
+    }
+
+    //
+    //	Map them to the logical cpus.
+    //
+    if (n && (dir = SysOpenDir("/sys/devices/system/cpu"))) {
+	while ((dp = readdir(dir))) {
+	    char dummy;
+
+	    if (sscanf(dp->d_name, "cpu%d%c", &cpu, &dummy) != 1 || cpu < 0) {
+		continue;
+	    }
+	    snprintf(file, sizeof(file),
+		"/sys/devices/system/cpu/cpu%d/topology/physical_package_id",
+		cpu);
+	    if (ReadString(file, buf, sizeof(buf)) <= 0) {
+		continue;		// offline
+	    }
+	    package = atoi(buf);
+	    snprintf(file, sizeof(file),
+		"/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+	    if (ReadString(file, buf, sizeof(buf)) <= 0) {
+		continue;
+	    }
+	    core = atoi(buf);
+
+	    for (i = 0; i < n; ++i) {
+		if (temps[i].Package == package && temps[i].Core == core) {
+		    break;
+		}
+	    }
+	    if (i == n) {
+		continue;
+	    }
+	    if (cpu >= CoreTempMapN) {
+		CoreTempMap =
+		    realloc(CoreTempMap, (cpu + 1) * sizeof(*CoreTempMap));
+		if (!CoreTempMap) {
+		    fprintf(stderr, "out of memory\n");
+		    abort();
+		}
+		memset(CoreTempMap + CoreTempMapN, 0,
+		    (cpu + 1 - CoreTempMapN) * sizeof(*CoreTempMap));
+		CoreTempMapN = cpu + 1;
+	    }
+	    CoreTempMap[cpu] = strdup(temps[i].Name);
+	    if (Verbose) {
+		printf("cpu%d: %s\n", cpu, temps[i].Name);
+	    }
+	}
+	closedir(dir);
+    }
+
+    for (i = 0; i < n; ++i) {
+	free(temps[i].Name);
+    }
+    free(temps);
+}
+
+/**
+**	Get the temperature input file of a logical cpu.
+**
+**	@param cpu	logical cpu number
+**	@param[out] buf	buffer for fallback file name
+**	@param size	size of buffer
+**
+**	@returns the file name of the coretemp input of the cpu.
+*/
+static const char *CoreTempName(int cpu, char *buf, size_t size)
+{
+    if (cpu < CoreTempMapN && CoreTempMap[cpu]) {
+	return CoreTempMap[cpu];
+    }
+    // linux 5.00 coretemp, sensor 1 is the package
+    snprintf(buf, size, "%s%d_input", CoreThermalNames, 2 + cpu);
+    return buf;
+}
+
+/**
+**	Get the logical cpu of a frequency of a window.
+**
+**	@param dockapp	window
+**	@param i	cpu index in the window
+**	@param j	0 or 1 for the second of two joined cpus
+**
+**	@returns the logical cpu number.
+*/
+static int FreqCpu(const Dockapp * dockapp, int i, int j)
+{
+    return dockapp->StartCpu + (i << dockapp->JoinFreq)
+	+ (dockapp->JoinFreq ? j : 0);
+}
+
+/**
+**	Temperature, which can be selected by name as thermal zone.
+*/
+typedef struct _zone_
+{
+    char *Type;				///< thermal zone type or hwmon chip
+    char *Label;			///< hwmon label or "tempN", NULL for zones
+    char *Name;				///< file name of the temperature
+    int Order;				///< sort key: zone or hwmon and input nr
+} Zone;
+
+static Zone *Zones;			///< all selectable temperatures
+static int ZoneN;			///< number of selectable temperatures
+static char *ZoneFiles[ZONE_MAX];	///< resolved thermal zone file names
+
+/**
+**	Add a selectable temperature.
+**
+**	@param type	thermal zone type or hwmon chip name
+**	@param label	hwmon label, NULL for thermal zones
+**	@param name	file name of the temperature
+**	@param order	sort key
+*/
+static void ZoneAdd(const char *type, const char *label, const char *name,
+    int order)
+{
+    Zones = realloc(Zones, (ZoneN + 1) * sizeof(*Zones));
+    if (!Zones) {
+	fprintf(stderr, "out of memory\n");
+	abort();
+    }
+    Zones[ZoneN].Type = strdup(type);
+    Zones[ZoneN].Label = label ? strdup(label) : NULL;
+    Zones[ZoneN].Name = strdup(name);
+    Zones[ZoneN].Order = order;
+    ++ZoneN;
+}
+
+/**
+**	Compare two temperatures by their sort key, for qsort(3).
+*/
+static int ZoneCompare(const void *a, const void *b)
+{
+    return ((const Zone *)a)->Order - ((const Zone *)b)->Order;
+}
+
+/**
+**	Enumerate all thermal zones and hwmon temperature inputs.
+**
+**	Thermal zones come first in zone number order, then the hwmon
+**	inputs in device and input number order.  Only called at startup
+**	and on hotplug.
+*/
+static void ZoneDiscover(void)
+{
+    DIR *dir;
+    DIR *hwmon;
+    struct dirent *dp;
+    struct dirent *hp;
+    char file[512];
+    char type[64];
+    char label[64];
+    int first;
+    int i;
+    int nr;
+    int id;
+
+    for (i = 0; i < ZoneN; ++i) {
+	free(Zones[i].Type);
+	free(Zones[i].Label);
+	free(Zones[i].Name);
+    }
+    ZoneN = 0;
+
+    if ((dir = SysOpenDir("/sys/class/thermal"))) {
+	while ((dp = readdir(dir))) {
+	    char dummy;
+
+	    if (sscanf(dp->d_name, "thermal_zone%d%c", &nr, &dummy) != 1) {
+		continue;
+	    }
+	    snprintf(file, sizeof(file), "/sys/class/thermal/%s/type",
+		dp->d_name);
+	    if (ReadString(file, type, sizeof(type)) <= 0) {
+		continue;
+	    }
+	    snprintf(file, sizeof(file), "/sys/class/thermal/%s/temp",
+		dp->d_name);
+	    ZoneAdd(type, NULL, file, nr);
+	}
+	closedir(dir);
+    }
+    if (ZoneN) {
+	qsort(Zones, ZoneN, sizeof(*Zones), ZoneCompare);
+    }
+
+    first = ZoneN;
+    if ((dir = SysOpenDir("/sys/class/hwmon"))) {
+	while ((dp = readdir(dir))) {
+	    if (sscanf(dp->d_name, "hwmon%d", &id) != 1) {
+		continue;
+	    }
+	    if (HwmonName(dp->d_name, file, sizeof(file), type, sizeof(type))
+		|| !(hwmon = SysOpenDir(file))) {
+		continue;
+	    }
+	    while ((hp = readdir(hwmon))) {
+		char name[1024];
+		int end;
+
+		end = 0;
+		if (sscanf(hp->d_name, "temp%d_input%n", &nr, &end) != 1
+		    || !end || hp->d_name[end]) {
+		    continue;
+		}
+		snprintf(name, sizeof(name), "%s/temp%d_label", file, nr);
+		if (ReadString(name, label, sizeof(label)) <= 0) {
+		    snprintf(label, sizeof(label), "temp%d", nr);
+		}
+		snprintf(name, sizeof(name), "%s/%s", file, hp->d_name);
+		ZoneAdd(type, label, name, id * 1024 + nr);
+	    }
+	    closedir(hwmon);
+	}
+	closedir(dir);
+    }
+    if (ZoneN > first) {
+	qsort(Zones + first, ZoneN - first, sizeof(*Zones), ZoneCompare);
+    }
+
+    if (Verbose) {
+	for (i = 0; i < ZoneN; ++i) {
+	    printf("zone %s%s%s: %s\n", Zones[i].Type,
+		Zones[i].Label ? ":" : "",
+		Zones[i].Label ? Zones[i].Label : "", Zones[i].Name);
+	}
+    }
+}
+
+/**
+**	Resolve the selected thermal zones to file names.
+**
+**	A selection is a file name (starting with '/'), a thermal zone type
+**	or hwmon chip name (f.e. "acpitz", "x86_pkg_temp", "nvme"), a chip
+**	name and label (f.e. "coretemp:Package id 0") or only a label (f.e.
+**	"Tctl").  A name selected again gets the next match, so "acpitz"
+**	twice selects two ACPI zones.  The result is cached in #ZoneFiles,
+**	sampling didn't look up any name.
+*/
+static void ZoneResolve(void)
+{
+    char buf[128];
+    char *taken;
+    const char *select;
+    int pass;
+    int i;
+    int j;
+
+    taken = calloc(ZoneN + 1, 1);
+    if (!taken) {
+	fprintf(stderr, "out of memory\n");
+	abort();
+    }
+    for (i = 0; i < ThermalZones; ++i) {
+	free(ZoneFiles[i]);
+	ZoneFiles[i] = NULL;
+	if (!(select = ThermalZoneNames[i])) {
+	    snprintf(buf, sizeof(buf),
+		"/sys/class/thermal/thermal_zone%d/temp", i);
+	    select = buf;
+	}
+	if (*select == '/') {
+	    ZoneFiles[i] = strdup(select);
+	    continue;
+	}
+	// type first, then type:label, then label
+	for (pass = 0; pass < 3 && !ZoneFiles[i]; ++pass) {
+	    for (j = 0; j < ZoneN; ++j) {
+		const Zone *zone;
+
+		zone = Zones + j;
+		if (taken[j]) {
+		    continue;
+		}
+		if (pass == 0 && strcmp(zone->Type, select)) {
+		    continue;
+		}
+		if (pass == 1 && (!zone->Label
+			|| strncmp(zone->Type, select, strlen(zone->Type))
+			|| select[strlen(zone->Type)] != ':'
+			|| strcmp(zone->Label,
+			    select + strlen(zone->Type) + 1))) {
+		    continue;
+		}
+		if (pass == 2 && (!zone->Label
+			|| strcmp(zone->Label, select))) {
+		    continue;
+		}
+		taken[j] = 1;
+		ZoneFiles[i] = strdup(zone->Name);
+		break;
+	    }
+	}
+	if (!ZoneFiles[i]) {
+	    fprintf(stderr, "thermal zone '%s' not found\n", select);
+	    ZoneFiles[i] = strdup(select);
+	} else if (Verbose) {
+	    printf("thermal zone %d: %s\n", i, ZoneFiles[i]);
+	}
+    }
+    free(taken);
+}
+
+/**
+**	Open the netlink uevent socket for cpu and hwmon hotplug.
+*/
+static void UeventOpen(void)
+{
+    struct sockaddr_nl addr;
+
+    UeventFD = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+	NETLINK_KOBJECT_UEVENT);
+    if (UeventFD < 0) {
+	return;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1;			// kernel uevents
+    if (bind(UeventFD, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+	close(UeventFD);
+	UeventFD = -1;
+    }
+}
+
+/**
+**	Read all pending uevents.
+**
+**	@returns #UEVENT_HOTPLUG if a cpu or hwmon device was added or
+**	removed, #UEVENT_ALARM if a hwmon device or thermal zone reported a
+**	change (f.e. a crossed trip point).
+*/
+static int UeventRead(void)
+{
+    char buf[4096];
+    int events;
+    int change;
+    int n;
+    int i;
+
+    events = 0;
+    while ((n = recv(UeventFD, buf, sizeof(buf) - 1, 0)) > 0) {
+	buf[n] = '\0';
+	// "action@devpath\0KEY=value\0..."
+	change = !strncmp(buf, "change@", 7);
+	for (i = 0; i < n; i += strlen(buf + i) + 1) {
+	    if (!strcmp(buf + i, "SUBSYSTEM=cpu")) {
+		events |= change ? 0 : UEVENT_HOTPLUG;
+	    } else if (!strcmp(buf + i, "SUBSYSTEM=hwmon")) {
+		events |= change ? UEVENT_ALARM : UEVENT_HOTPLUG;
+	    } else if (!strcmp(buf + i, "SUBSYSTEM=thermal")) {
+		events |= change ? UEVENT_ALARM : 0;
+	    }
+	}
+    }
+    return events;
+}
+
+/**
+**	Watch the alarm files of all temperature sensors.
+**
+**	hwmon drivers, which support it, notify changes of tempN_alarm,
+**	tempN_max_alarm and tempN_crit_alarm with sysfs_notify(), poll(2)
+**	returns POLLPRI.  A file must be read once, before it is polled.
+**	Files of other filesystems never return POLLPRI.  The first two
+**	poll slots are left for the timer and the uevent socket.
+*/
+static void AlarmSetup(void)
+{
+    static const char *const suffixes[] = {
+	"_alarm", "_max_alarm", "_crit_alarm"
+    };
+    char buf[128];
+    const char *name;
+    size_t len;
+    int fd;
+    int i;
+    int j;
+
+    for (i = 0; i < AlarmN; ++i) {
+	if (Alarms[2 + i].fd >= 0) {
+	    close(Alarms[2 + i].fd);
+	}
+    }
+    AlarmN = 0;
+    if (!Alarms && !(Alarms = malloc(2 * sizeof(*Alarms)))) {
+	fprintf(stderr, "out of memory\n");
+	abort();
+    }
+    for (i = 0; i < SensorN && !ReplayName; ++i) {
+	if (!Sensors[i].Temperature || Sensors[i].Virtual) {
+	    continue;
+	}
+	// only hwmon inputs, thermal zones report with uevents
+	name = Sensors[i].Name;
+	len = strlen(name);
+	if (len < 6 || strcmp(name + len - 6, "_input")) {
+	    continue;
+	}
+	for (j = 0; j < 3; ++j) {
+	    snprintf(buf, sizeof(buf), "%.*s%s", (int)(len - 6), name,
+		suffixes[j]);
+	    if ((fd = SysOpen(buf, O_RDONLY)) < 0) {
+		continue;
+	    }
+	    if (pread(fd, buf, sizeof(buf), 0) < 0) {
+		close(fd);
+		continue;
+	    }
+	    Alarms = realloc(Alarms, (2 + AlarmN + 1) * sizeof(*Alarms));
+	    if (!Alarms) {
+		fprintf(stderr, "out of memory\n");
+		abort();
+	    }
+	    Alarms[2 + AlarmN].fd = fd;
+	    Alarms[2 + AlarmN].events = POLLPRI;
+	    ++AlarmN;
+	}
+    }
+    if (Verbose) {
+	printf("%d alarm files watched\n", AlarmN);
+	fflush(stdout);
+    }
+}
+
+/**
+**	Read all notified alarm files, this rearms the notification.
+**
+**	@returns true if any alarm file was notified.
+*/
+static int AlarmRead(void)
+{
+    char buf[32];
+    int alarm;
+    int i;
+
+    alarm = 0;
+    for (i = 2; i < 2 + AlarmN; ++i) {
+	if (Alarms[i].revents & (POLLPRI | POLLERR)) {
+	    alarm = 1;
+	    if (pread(Alarms[i].fd, buf, sizeof(buf), 0) < 0) {
+		// device gone, the hotplug uevent reopens it
+		close(Alarms[i].fd);
+		Alarms[i].fd = -1;
+	    }
+	}
+    }
+    return alarm;
+}
+
+/**
+**	Rebuild the sensor map after cpu or hwmon hotplug.
+**
+**	Runs in the sampler thread.  The names are replaced and discovery
+**	prints with -v, the metrics dump of the X11 thread is locked out.
+*/
+static void SensorRebuild(void)
+{
+    char buf[128];
+    const Dockapp *dockapp;
+    int i;
+
+    pthread_mutex_lock(&SensorNameLock);
+    HwmonDiscover();
+    for (dockapp = Dockapps; dockapp < Dockapps + DockappN; ++dockapp) {
+	for (i = 0; i < dockapp->Cpus; ++i) {
+	    SensorRebind(dockapp->CpuTempSensors[i],
+		CoreTempName(dockapp->CpuTempCpus[i], buf, sizeof(buf)));
+	}
+    }
+    ZoneDiscover();
+    ZoneResolve();
+    for (i = 0; i < ThermalZones; ++i) {
+	SensorRebind(ZoneSensors[i], ZoneFiles[i]);
+    }
+    AlarmSetup();
+    fflush(stdout);
+    pthread_mutex_unlock(&SensorNameLock);
+}
+
+// ------------------------------------------------------------------------- //
+
+/**
+**	Read number.
+**
+**	@param handle	sensor handle of file containing only the number
+**
+**	@returns the number read, -1 if the sensor isn't readable.
+**
+**	If the device is gone (cpu or hwmon hotplug), the file is reopened.
+*/
+static int ReadNumber(int handle)
+{
+    Sensor *sensor;
+    int n;
+    char buf[32];
+
+    sensor = Sensors + handle;
+    if (sensor->Virtual) {		// set by its backend
+	return sensor->Value;
+    }
+    if (sensor->FD < 0 && SensorOpen(sensor) < 0) {
+	return -1;
+    }
+    ++SensorSyscalls;
+    n = pread(sensor->FD, buf, sizeof(buf) - 1, 0);
+    if (n < 0 && (errno == ENODEV || errno == ESTALE || errno == ENOENT)) {
+	// device removed and maybe added again, try once to reopen
+	if (SensorOpen(sensor) < 0) {
+	    return -1;
+	}
+	++SensorSyscalls;
+	n = pread(sensor->FD, buf, sizeof(buf) - 1, 0);
+    }
+    if (n > 0) {
+	buf[n] = '\0';
+	n = atol(buf);
+    }
+    return n;
+}
+
+#ifdef IO_URING
+
+/**
+**	io_uring sampling backend.
+**
+**	The reads of all sensors are submitted in one batch and the
+**	completions are collected with the same io_uring_enter(2).
+*/
+static struct
+{
+    int FD;				///< io_uring file descriptor or -1
+    unsigned Entries;			///< number of submission entries
+    unsigned *SqHead;			///< submission queue head
+    unsigned *SqTail;			///< submission queue tail
+    unsigned *SqMask;			///< submission queue index mask
+    unsigned *SqArray;			///< submission queue index array
+    struct io_uring_sqe *Sqes;		///< submission queue entries
+    unsigned *CqHead;			///< completion queue head
+    unsigned *CqTail;			///< completion queue tail
+    unsigned *CqMask;			///< completion queue index mask
+    struct io_uring_cqe *Cqes;		///< completion queue entries
+} Uring = {
+.FD = -1};
+
+/**
+**	Setup io_uring for sensor sampling.
+**
+**	@param entries	number of sensors to sample per batch
+**
+**	@returns 0 on success, -1 if io_uring isn't supported.
+*/
+static int UringSetup(unsigned entries)
+{
+    struct io_uring_params params;
+    size_t sq_size;
+    size_t cq_size;
+    uint8_t *sq;
+    uint8_t *cq;
+    int fd;
+
+    memset(&params, 0, sizeof(params));
+    fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+	return -1;
+    }
+
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size =
+	params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+	if (cq_size > sq_size) {
+	    sq_size = cq_size;
+	}
+	cq_size = sq_size;
+    }
+    sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+	MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+	close(fd);
+	return -1;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+	cq = sq;
+    } else {
+	cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	if (cq == MAP_FAILED) {
+	    munmap(sq, sq_size);
+	    close(fd);
+	    return -1;
+	}
+    }
+    Uring.Sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+	PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+	IORING_OFF_SQES);
+    if (Uring.Sqes == MAP_FAILED) {
+	if (cq != sq) {
+	    munmap(cq, cq_size);
+	}
+	munmap(sq, sq_size);
+	close(fd);
+	return -1;
+    }
+
+    Uring.SqHead = (unsigned *)(sq + params.sq_off.head);
+    Uring.SqTail = (unsigned *)(sq + params.sq_off.tail);
+    Uring.SqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+    Uring.SqArray = (unsigned *)(sq + params.sq_off.array);
+    Uring.CqHead = (unsigned *)(cq + params.cq_off.head);
+    Uring.CqTail = (unsigned *)(cq + params.cq_off.tail);
+    Uring.CqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+    Uring.Cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    Uring.Entries = params.sq_entries;
+    Uring.FD = fd;
+
+    return 0;
+}
+
+/**
+**	Sample all sensors with one io_uring batch.
+**
+**	@returns 0 on success, -1 if the caller must fallback to pread(2).
+*/
+static int UringSample(void)
+{
+    int i;
+    int n;
+    int done;
+    int submitted;
+    unsigned tail;
+    unsigned head;
+
+    for (i = 0; i < SensorN;) {
+	//
+	//	Queue reads of all open sensors
+	//
+	tail = *Uring.SqTail;
+	for (n = 0; i < SensorN && (unsigned)n < Uring.Entries; ++i) {
+	    struct io_uring_sqe *sqe;
+	    unsigned idx;
+
+	    if (Sensors[i].Virtual) {	// not a file
+		continue;
+	    }
+	    idx = tail & *Uring.SqMask;
+	    sqe = Uring.Sqes + idx;
+	    memset(sqe, 0, sizeof(*sqe));
+	    sqe->opcode = IORING_OP_READ;
+	    sqe->fd = Sensors[i].FD;
+	    sqe->addr = (uintptr_t) Sensors[i].Buf;
+	    sqe->len = sizeof(Sensors[i].Buf) - 1;
+	    sqe->off = 0;
+	    sqe->user_data = i;
+	    Uring.SqArray[idx] = idx;
+	    if (sqe->fd < 0) {		// not open: let it fail fast
+		sqe->opcode = IORING_OP_NOP;
+		sqe->user_data |= 1ULL << 32;
+	    }
+	    ++tail;
+	    ++n;
+	}
+	if (!n) {
+	    break;
+	}
+	__atomic_store_n(Uring.SqTail, tail, __ATOMIC_RELEASE);
+
+	//
+	//	Submit and wait for all completions
+	//
+	++SensorSyscalls;
+	submitted = syscall(__NR_io_uring_enter, Uring.FD, n, n,
+	    IORING_ENTER_GETEVENTS, NULL, 0);
+	if (submitted < 0 && errno != EINTR) {
+	    return -1;
+	}
+	if (submitted < 0) {
+	    submitted = n - (tail - __atomic_load_n(Uring.SqHead,
+		    __ATOMIC_ACQUIRE));
+	}
+
+	done = 0;
+	for (;;) {
+	    head = *Uring.CqHead;
+	    while (head != __atomic_load_n(Uring.CqTail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe;
+		Sensor *sensor;
+		int res;
+
+		cqe = Uring.Cqes + (head & *Uring.CqMask);
+		sensor = Sensors + (uint32_t) cqe->user_data;
+		res = cqe->res;
+		if (cqe->user_data >> 32) {	// not open, try reopen
+		    sensor->Value = ReadNumber(sensor - Sensors);
+		} else if (res > 0) {
+		    sensor->Buf[res] = '\0';
+		    sensor->Value = atol(sensor->Buf);
+		} else if (res == -EINVAL || res == -EOPNOTSUPP) {
+		    // IORING_OP_READ needs linux 5.6
+		    sensor->Value = ReadNumber(sensor - Sensors);
+		    head++;
+		    __atomic_store_n(Uring.CqHead, head, __ATOMIC_RELEASE);
+		    return -1;
+		} else {
+		    // ENODEV/ESTALE: ReadNumber() reopens the file
+		    sensor->Value = ReadNumber(sensor - Sensors);
+		}
+		++done;
+		++head;
+	    }
+	    __atomic_store_n(Uring.CqHead, head, __ATOMIC_RELEASE);
+	    if (done >= submitted) {
+		break;
+	    }
+	    ++SensorSyscalls;
+	    if (syscall(__NR_io_uring_enter, Uring.FD, 0, submitted - done,
+		    IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+		return -1;
+	    }
+	}
+	if (submitted < n) {		// not all submitted, fallback
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+#endif
+
+/**
+**	Sample all sensors.
+**
+**	The draw functions only use the sampled values, it doesn't matter
+**	which backend has read them.
+**
+**	@returns true, if the sensors are read one by one and timed.
+**
+**	io_uring reads all sensors at once, every 64th sample is read with
+**	pread to get the read latency of each sensor.
+*/
+static int SensorSample(void)
+{
+    static unsigned samples;
+    uint64_t start;
+    uint64_t now;
+    int i;
+
+#ifdef IO_URING
+    if (Uring.FD >= 0 && (samples++ & 63)) {
+	if (!UringSample()) {
+	    return 0;
+	}
+	// io_uring failed, fallback for good
+	close(Uring.FD);
+	Uring.FD = -1;
+	if (Verbose) {
+	    printf("io_uring sampling failed, fallback to pread\n");
+	}
+    }
+#else
+    (void)samples;
+#endif
+    start = NowNs();
+    for (i = 0; i < SensorN; ++i) {
+	if (!Sensors[i].Virtual) {
+	    Sensors[i].Value = ReadNumber(i);
+	    now = NowNs();
+	    HistogramAdd(SensorHistograms + i, now - start);
+	    start = now;
+	}
+    }
+    return 1;
+}
+
+#ifdef EFFECTIVE_FREQ
+
+#define MSR_IA32_MPERF 0xE7		///< maximum performance counter
+#define MSR_IA32_APERF 0xE8		///< actual performance counter
+
+/**
+**	Effective frequency counters of one cpu.
+*/
+typedef struct _effective_
+{
+    int Cpu;				///< logical cpu number
+    int Handle;				///< virtual sensor handle
+    int FD;				///< msr file or perf group leader
+    int RefFD;				///< perf ref-cycles counter
+    uint64_t Actual;			///< last APERF or cycles
+    uint64_t Reference;			///< last MPERF or ref-cycles
+} Effective;
+
+    /// effective frequency backends
+static enum
+{
+    EFFECTIVE_NONE,			///< use cpufreq sysfs
+    EFFECTIVE_MSR,			///< APERF/MPERF from /dev/cpu/N/msr
+    EFFECTIVE_PERF,			///< perf_event cycles/ref-cycles
+} EffectiveBackend;
+
+static Effective *Effectives;		///< effective frequency counters
+static int EffectiveN;			///< number of counters
+static uint64_t EffectiveTsc;		///< TSC of last sample
+static struct timespec EffectiveTime;	///< time of last sample
+
+/**
+**	Read the counters of one cpu.
+**
+**	@param eff		effective frequency counters
+**	@param[out] actual	APERF or cycles
+**	@param[out] reference	MPERF or ref-cycles
+**
+**	@returns 0 on success, -1 on failure.
+*/
+static int EffectiveRead(const Effective * eff, uint64_t * actual,
+    uint64_t * reference)
+{
+    uint64_t buf[3];
+
+    if (EffectiveBackend == EFFECTIVE_MSR) {
+	SensorSyscalls += 2;
+	if (pread(eff->FD, actual, sizeof(*actual),
+		MSR_IA32_APERF) != sizeof(*actual)
+	    || pread(eff->FD, reference, sizeof(*reference),
+		MSR_IA32_MPERF) != sizeof(*reference)) {
+	    return -1;
+	}
+	return 0;
+    }
+    // PERF_FORMAT_GROUP: nr, cycles, ref-cycles
+    ++SensorSyscalls;
+    if (read(eff->FD, buf, sizeof(buf)) != sizeof(buf) || buf[0] != 2) {
+	return -1;
+    }
+    *actual = buf[1];
+    *reference = buf[2];
+    return 0;
+}
+
+/**
+**	Open the counters of one cpu.
+**
+**	@param eff	effective frequency counters, Cpu must be set
+**	@param backend	backend to use
+**
+**	@returns 0 on success, -1 if the backend isn't available.
+*/
+static int EffectiveOpen(Effective * eff, int backend)
+{
+    struct perf_event_attr attr;
+    char buf[64];
+
+    eff->FD = eff->RefFD = -1;
+    if (backend == EFFECTIVE_MSR) {
+	snprintf(buf, sizeof(buf), "/dev/cpu/%d/msr", eff->Cpu);
+	eff->FD = open(buf, O_RDONLY | O_CLOEXEC);
+	return eff->FD < 0 ? -1 : 0;
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.read_format = PERF_FORMAT_GROUP;
+    eff->FD = syscall(__NR_perf_event_open, &attr, -1, eff->Cpu, -1,
+	PERF_FLAG_FD_CLOEXEC);
+    if (eff->FD < 0) {
+	return -1;
+    }
+    attr.config = PERF_COUNT_HW_REF_CPU_CYCLES;
+    eff->RefFD = syscall(__NR_perf_event_open, &attr, -1, eff->Cpu, eff->FD,
+	PERF_FLAG_FD_CLOEXEC);
+    if (eff->RefFD < 0) {
+	close(eff->FD);
+	eff->FD = -1;
+	return -1;
+    }
+    return 0;
+}
+
+/**
+**	Close the counters of all cpus.
+*/
+static void EffectiveClose(void)
+{
+    int i;
+
+    for (i = 0; i < EffectiveN; ++i) {
+	if (Effectives[i].RefFD >= 0) {
+	    close(Effectives[i].RefFD);
+	}
+	if (Effectives[i].FD >= 0) {
+	    close(Effectives[i].FD);
+	}
+	Effectives[i].FD = Effectives[i].RefFD = -1;
+    }
+}
+
+/**
+**	Setup the effective frequency counters of all cpus.
+**
+**	The first backend (msr, perf), which works for all cpus, is used.
+**	Otherwise the cpufreq sysfs files are used.
+*/
+static void EffectiveSetup(void)
+{
+    char buf[64];
+    const Dockapp *dockapp;
+    int backend;
+    int i;
+    int j;
+    int k;
+    int cpu;
+
+    k = 0;
+    for (dockapp = Dockapps; dockapp < Dockapps + DockappN; ++dockapp) {
+	k += 2 * dockapp->Cpus;
+    }
+    Effectives = malloc(k * sizeof(*Effectives));
+    if (!Effectives) {
+	fprintf(stderr, "out of memory\n");
+	abort();
+    }
+    for (backend = EFFECTIVE_MSR; backend <= EFFECTIVE_PERF; ++backend) {
+	EffectiveN = 0;
+	for (dockapp = Dockapps; dockapp < Dockapps + DockappN; ++dockapp) {
+	    for (i = 0; i < dockapp->Cpus; ++i) {
+		for (j = 0; j < 2; ++j) {
+		    cpu = FreqCpu(dockapp, i, j);
+		    for (k = 0; k < EffectiveN; ++k) {
+			if (Effectives[k].Cpu == cpu) {
+			    break;
+			}
+		    }
+		    if (k < EffectiveN) {	// already open
+			continue;
+		    }
+		    Effectives[k].Cpu = cpu;
+		    if (EffectiveOpen(Effectives + k, backend)) {
+			goto next;
+		    }
+		    ++EffectiveN;
+		}
+	    }
+	}
+	EffectiveBackend = backend;
+	break;
+
+      next:
+	EffectiveClose();
+    }
+    if (Verbose) {
+	printf("effective frequency from %s\n",
+	    EffectiveBackend == EFFECTIVE_MSR ? "APERF/MPERF msr" :
+	    EffectiveBackend == EFFECTIVE_PERF ? "perf cycle counters" :
+	    "cpufreq (not available)");
+    }
+    if (EffectiveBackend == EFFECTIVE_NONE) {
+	EffectiveN = 0;
+	return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &EffectiveTime);
+    EffectiveTsc = __rdtsc();
+    for (k = 0; k < EffectiveN; ++k) {
+	EffectiveRead(Effectives + k, &Effectives[k].Actual,
+	    &Effectives[k].Reference);
+	snprintf(buf, sizeof(buf), "effective frequency cpu%d",
+	    Effectives[k].Cpu);
+	Effectives[k].Handle = SensorAddVirtual(buf);
+    }
+}
+
+/**
+**	Get the virtual sensor for the effective frequency of a cpu.
+**
+**	@param cpu	logical cpu number
+**
+**	@returns the sensor handle, -1 if cpufreq sysfs must be used.
+*/
+static int EffectiveHandle(int cpu)
+{
+    int i;
+
+    for (i = 0; i < EffectiveN; ++i) {
+	if (Effectives[i].Cpu == cpu) {
+	    return Effectives[i].Handle;
+	}
+    }
+    return -1;
+}
+
+/**
+**	Sample the average effective frequency since the last sample.
+**
+**	frequency = TSC rate * delta APERF / delta MPERF, MPERF and
+**	ref-cycles count with the (invariant) TSC rate while not halted.
+*/
+static void EffectiveSample(void)
+{
+    struct timespec now;
+    uint64_t tsc;
+    uint64_t actual;
+    uint64_t reference;
+    int64_t ns;
+    double khz;
+    int i;
+
+    if (!EffectiveN) {
+	return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    tsc = __rdtsc();
+    ns = (now.tv_sec - EffectiveTime.tv_sec) * 1000000000LL
+	+ now.tv_nsec - EffectiveTime.tv_nsec;
+    // TSC rate in kHz
+    khz = ns > 0 ? (tsc - EffectiveTsc) * 1e6 / ns : 0;
+    EffectiveTime = now;
+    EffectiveTsc = tsc;
+
+    for (i = 0; i < EffectiveN; ++i) {
+	Effective *eff;
+	Sensor *sensor;
+
+	eff = Effectives + i;
+	sensor = Sensors + eff->Handle;
+	if (EffectiveRead(eff, &actual, &reference)) {
+	    sensor->Value = -1;
+	    continue;
+	}
+	if (reference != eff->Reference) {
+	    sensor->Value = khz * (actual - eff->Actual)
+		/ (reference - eff->Reference);
+	}				// else idle whole interval, keep value
+	eff->Actual = actual;
+	eff->Reference = reference;
+    }
+}
+
+#endif
+
+/**
+**	Setup the thermal throttle sensors of the cpus of a window.
+**
+**	@param dockapp	window, gets the throttle count handles
+**	@param buf	scratch buffer for the file names
+**	@param size	size of scratch buffer
+**
+**	The core and package counts of the cpus of each frequency slot,
+**	both with -j, are read every update.  A count which changed since
+**	the last update marks the slot as throttled.  Counts, which can't be
+**	opened now (f.e. AMD or virtual machines), get no sensor, so they
+**	aren't retried every update.
+*/
+static void ThrottleSetup(Dockapp * dockapp, char *buf, size_t size)
+{
+    int i;
+    int j;
+    int fd;
+
+    dockapp->CpuThrottleSensors =
+	malloc(dockapp->Cpus * sizeof(*dockapp->CpuThrottleSensors));
+    if (!dockapp->CpuThrottleSensors) {
+	fprintf(stderr, "out of memory\n");
+	abort();
+    }
+    for (i = 0; i < dockapp->Cpus; ++i) {
+	for (j = 0; j < 4; ++j) {
+	    snprintf(buf, size,
+		"/sys/devices/system/cpu/cpu%d/thermal_throttle/%s"
+		"_throttle_count", FreqCpu(dockapp, i, j / 2),
+		j & 1 ? "package" : "core");
+	    dockapp->CpuThrottleSensors[i][j] = -1;
+	    if ((fd = SysOpen(buf, O_RDONLY)) >= 0) {
+		close(fd);
+		dockapp->CpuThrottleSensors[i][j] = SensorAdd(buf);
+	    }
+	}
+    }
+}
+
+/**
+**	Setup the sensor handles for the configured cpus and thermal zones.
+*/
+static void SensorSetup(void)
+{
+    char buf[128];
+    Dockapp *dockapp;
+    int cpus;
+    int i;
+    int j;
+
+    HwmonDiscover();
+    if (!ReplayName) {			// replay: no hotplug, no alarms
+	UeventOpen();
+    }
+
+    // scratch buffers for the reduction, big enough for all windows
+    cpus = 0;
+    for (dockapp = Dockapps; dockapp < Dockapps + DockappN; ++dockapp) {
+	if (dockapp->Cpus > cpus) {
+	    cpus = dockapp->Cpus;
+	}
+    }
+    CoreTemps = malloc(cpus * sizeof(*CoreTemps));
+    CoreFreqs = malloc(2 * cpus * sizeof(*CoreFreqs));
+    if (!CoreTemps || !CoreFreqs) {
+	fprintf(stderr, "out of memory\n");
+	abort();
+    }
+#ifdef EFFECTIVE_FREQ
+    if (EffectiveFreq) {
+	EffectiveSetup();
+    }
+#endif
+    // all names are build here, sampling didn't format any strings
+    // windows with overlapping cpus share the sensors
+    for (dockapp = Dockapps; dockapp < Dockapps + DockappN; ++dockapp) {
+	dockapp->CpuTempSensors =
+	    malloc(dockapp->Cpus * sizeof(*dockapp->CpuTempSensors));
+	dockapp->CpuTempCpus =
+	    malloc(dockapp->Cpus * sizeof(*dockapp->CpuTempCpus));
+	dockapp->CpuFreqSensors =
+	    malloc(dockapp->Cpus * sizeof(*dockapp->CpuFreqSensors));
+	if (!dockapp->CpuTempSensors || !dockapp->CpuTempCpus
+	    || !dockapp->CpuFreqSensors) {
+	    fprintf(stderr, "out of memory\n");
+	    abort();
+	}
+	for (i = 0; i < dockapp->Cpus; ++i) {
+	    dockapp->CpuTempCpus[i] =
+		dockapp->StartCpu + (i << dockapp->JoinTemp);
+	    dockapp->CpuTempSensors[i] =
+		SensorAdd(CoreTempName(dockapp->CpuTempCpus[i], buf,
+		    sizeof(buf)));
+	    Sensors[dockapp->CpuTempSensors[i]].Temperature = 1;
+	    for (j = 0; j < 2; ++j) {
+		int cpu;
+
+		cpu = FreqCpu(dockapp, i, j);
+#ifdef EFFECTIVE_FREQ
+		if ((dockapp->CpuFreqSensors[i][j] =
+			EffectiveHandle(cpu)) >= 0) {
+		    continue;
+		}
+#endif
+		snprintf(buf, sizeof(buf),
+		    "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq",
+		    cpu);
+		dockapp->CpuFreqSensors[i][j] = SensorAdd(buf);
+	    }
+	}
+	if (ThrottleShow) {
+	    ThrottleSetup(dockapp, buf, sizeof(buf));
+	}
+    }
+    ZoneDiscover();
+    ZoneResolve();
+    for (i = 0; i < ThermalZones; ++i) {
+	ZoneSensors[i] = SensorAdd(ZoneFiles[i]);
+	Sensors[ZoneSensors[i]].Temperature = 1;
+    }
+    AlarmSetup();
+
+#ifdef IO_URING
+    if (!UringSetup(SensorN) && Verbose) {
+	printf("using io_uring sensor sampling\n");
+    }
+#endif
+}
+
+/**
+**	Snapshot of all sensor values, published by the sampler thread.
+**
+**	A seqlock: the sequence is odd, while the sampler writes the values.
+**	The reader retries, until it got an even and unchanged sequence.
+*/
+static struct
+{
+    unsigned Seq;			///< sequence number
+    int N;				///< number of values
+    int *Values;			///< sampled values
+} Snapshot;
+
+static pthread_t SamplerThread;		///< sensor sampler thread
+
+/**
+**	Publish the sampled sensor values.
+*/
+static void SnapshotPublish(void)
+{
+    unsigned seq;
+    int i;
+
+    seq = Snapshot.Seq;
+    __atomic_store_n(&Snapshot.Seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (i = 0; i < Snapshot.N; ++i) {
+	__atomic_store_n(&Snapshot.Values[i], Sensors[i].Value,
+	    __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&Snapshot.Seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/**
+**	Read the latest published sensor values.
+**
+**	@param[out] values	buffer for #Snapshot.N values
+*/
+static void SnapshotRead(int *values)
+{
+    unsigned seq;
+    int i;
+
+    do {
+	while ((seq = __atomic_load_n(&Snapshot.Seq, __ATOMIC_ACQUIRE)) & 1) {
+	    sched_yield();		// sampler is writing
+	}
+	for (i = 0; i < Snapshot.N; ++i) {
+	    values[i] = __atomic_load_n(&Snapshot.Values[i], __ATOMIC_RELAXED);
+	}
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (seq != __atomic_load_n(&Snapshot.Seq, __ATOMIC_RELAXED));
+}
+
+/**
+**	Shared memory export of the sampled values.
+**
+**	Layout version 1, all fields are host endian:
+**	#ExportHeader, char Names[N][NameSize] and int32_t Values[N].
+**	Values are the raw sensor numbers (millidegree Celsius, kHz), -1 if
+**	unreadable.  Readers use the sequence as seqlock, like #Snapshot:
+**	wait for an even sequence, copy, retry if the sequence changed.
+*/
+typedef struct _export_header_
+{
+    uint32_t Magic;			///< #EXPORT_MAGIC
+    uint16_t Version;			///< #EXPORT_VERSION
+    uint16_t HeaderSize;		///< size of header, names follow
+    uint32_t N;				///< number of sensors
+    uint32_t NameSize;			///< size of one name (0 terminated)
+    uint32_t Seq;			///< seqlock, odd while writing
+    uint32_t Rate;			///< update rate in ms
+    uint64_t Updates;			///< number of updates
+    uint64_t Time;			///< CLOCK_REALTIME in ns of update
+} ExportHeader;
+
+#define EXPORT_MAGIC 0x6432636D		///< "mc2d"
+#define EXPORT_VERSION 1		///< layout version
+#define EXPORT_NAME_SIZE 128		///< size of a name
+
+static ExportHeader *Export;		///< mapped export, NULL if none
+static size_t ExportSize;		///< size of mapped export
+
+    /// names of the exported sensors
+#define ExportNames(export) \
+    ((char (*)[EXPORT_NAME_SIZE])((char *)(export) + (export)->HeaderSize))
+    /// values of the exported sensors
+#define ExportValues(export) \
+    ((int32_t *)((char *)(export) + (export)->HeaderSize \
+	+ (export)->N * (export)->NameSize))
+
+/**
+**	Begin writing the export, make the sequence odd.
+*/
+static inline void ExportBegin(void)
+{
+    __atomic_store_n(&Export->Seq, Export->Seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+**	End writing the export, make the sequence even.
+*/
+static inline void ExportEnd(void)
+{
+    __atomic_store_n(&Export->Seq, Export->Seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+**	Write the sensor names into the export.
+**
+**	Called at setup and after hotplug, from the sampler thread.
+*/
+static void ExportRename(void)
+{
+    int i;
+
+    if (!Export) {
+	return;
+    }
+    ExportBegin();
+    for (i = 0; i < SensorN; ++i) {
+	strncpy(ExportNames(Export)[i], Sensors[i].Name,
+	    EXPORT_NAME_SIZE - 1);
+    }
+    ExportEnd();
+}
+
+/**
+**	Publish the sampled values into the export.
+*/
+static void ExportPublish(void)
+{
+    struct timespec ts;
+    int32_t *values;
+    int i;
+
+    if (!Export) {
+	return;
+    }
+    clock_gettime(CLOCK_REALTIME, &ts);
+    values = ExportValues(Export);
+    ExportBegin();
+    for (i = 0; i < SensorN; ++i) {
+	__atomic_store_n(&values[i], Sensors[i].Value, __ATOMIC_RELAXED);
+    }
+    Export->Updates++;
+    Export->Rate = RateNext;
+    Export->Time = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    ExportEnd();
+}
+
+/**
+**	Create the shared memory export.
+**
+**	The object is created new under a temporary name and renamed over
+**	the name.  An existing object is never resized, readers which have
+**	it still mapped keep their memory and don't get SIGBUS.
+**
+**	@returns 0 on success, -1 on failure.
+*/
+static int ExportSetup(void)
+{
+    ExportHeader *export;
+    size_t size;
+    char tmp[NAME_MAX];
+    char path[PATH_MAX];
+    char to[PATH_MAX];
+    int fd;
+
+    size = sizeof(*export) + SensorN * (EXPORT_NAME_SIZE + sizeof(int32_t));
+    snprintf(tmp, sizeof(tmp), "%s.%d", ExportName, getpid());
+    if ((fd =
+	    shm_open(tmp, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) < 0) {
+	fprintf(stderr, "Can't open shared memory '%s': %s\n", tmp,
+	    strerror(errno));
+	return -1;
+    }
+    if (ftruncate(fd, size)
+	|| (export =
+	    mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		0)) == MAP_FAILED) {
+	fprintf(stderr, "Can't map shared memory '%s': %s\n", tmp,
+	    strerror(errno));
+	close(fd);
+	shm_unlink(tmp);
+	return -1;
+    }
+    close(fd);
+
+    // zeroed by ftruncate, the magic is written last
+    export->Version = EXPORT_VERSION;
+    export->HeaderSize = sizeof(*export);
+    export->N = SensorN;
+    export->NameSize = EXPORT_NAME_SIZE;
+    export->Rate = Rate;
+    __atomic_store_n(&export->Magic, EXPORT_MAGIC, __ATOMIC_RELEASE);
+
+    // linux keeps the POSIX shared memory objects in /dev/shm
+    snprintf(path, sizeof(path), "/dev/shm%s", tmp);
+    snprintf(to, sizeof(to), "/dev/shm%s", ExportName);
+    if (rename(path, to)) {
+	fprintf(stderr, "Can't rename shared memory '%s': %s\n", tmp,
+	    strerror(errno));
+	munmap(export, size);
+	shm_unlink(tmp);
+	return -1;
+    }
+
+    Export = export;
+    ExportSize = size;
+    ExportRename();
+    return 0;
+}
+
+/**
+**	Remove the shared memory export.
+*/
+static void ExportExit(void)
+{
+    if (Export) {
+	munmap(Export, ExportSize);
+	Export = NULL;
+	shm_unlink(ExportName);
+    }
+}
+
+/**
+**	Reference reader of the shared memory export.
+**
+**	@param name	shared memory name
+**
+**	@returns 0 on success, -1 on failure.
+**
+**	Prints all sensors once.  The mapping can be kept and read again
+**	without any syscall.
+*/
+static int ExportRead(const char *name)
+{
+    const ExportHeader *export;
+    struct stat st;
+    char (*names)[EXPORT_NAME_SIZE];
+    int32_t *values;
+    uint64_t time;
+    unsigned seq;
+    unsigned i;
+    int fd;
+
+    if ((fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0)) < 0) {
+	fprintf(stderr, "Can't open shared memory '%s': %s\n", name,
+	    strerror(errno));
+	return -1;
+    }
+    if (fstat(fd, &st) || st.st_size < (off_t) sizeof(*export)
+	|| (export =
+	    mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd,
+		0)) == MAP_FAILED) {
+	fprintf(stderr, "Can't map shared memory '%s'\n", name);
+	close(fd);
+	return -1;
+    }
+    close(fd);
+    if (__atomic_load_n(&export->Magic, __ATOMIC_ACQUIRE) != EXPORT_MAGIC
+	|| export->Version != EXPORT_VERSION
+	|| export->NameSize != EXPORT_NAME_SIZE
+	|| (off_t) (export->HeaderSize + export->N * (export->NameSize +
+		sizeof(int32_t))) > st.st_size) {
+	fprintf(stderr, "Unsupported shared memory layout '%s'\n", name);
+	munmap((void *)export, st.st_size);
+	return -1;
+    }
+
+    names = malloc(export->N * sizeof(*names));
+    values = malloc(export->N * sizeof(*values));
+    if (!names || !values) {
+	fprintf(stderr, "out of memory\n");
+	abort();
+    }
+    do {
+	while ((seq = __atomic_load_n(&export->Seq, __ATOMIC_ACQUIRE)) & 1) {
+	    sched_yield();		// wmc2d is writing
+	}
+	memcpy(names, ExportNames(export), export->N * sizeof(*names));
+	memcpy(values, ExportValues(export), export->N * sizeof(*values));
+	time = export->Time;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (seq != __atomic_load_n(&export->Seq, __ATOMIC_RELAXED));
+
+    printf("# version %u, %u sensors, %u ms rate, %llu updates, "
+	"time %llu.%09llu\n", export->Version, export->N, export->Rate,
+	(unsigned long long)export->Updates,
+	(unsigned long long)time / 1000000000,
+	(unsigned long long)time % 1000000000);
+    for (i = 0; i < export->N; ++i) {
+	names[i][EXPORT_NAME_SIZE - 1] = '\0';
+	printf("%s %d\n", names[i], values[i]);
+    }
+
+    free(names);
+    free(values);
+    munmap((void *)export, st.st_size);
+    return 0;
+}
+
+/**
+**	Binary sample recorder in a memory mapped ring file.
+**
+**	Layout version 1, all fields are host endian:
+**	#RecordHeader, char Names[N][NameSize], the staging area
+**	uint32_t StageMs[BlockTicks] and int32_t StageValues[BlockTicks][N]
+**	and the ring of RingSize bytes.
+**
+**	Every update stores its values into the next staging row, these are
+**	plain stores into the mapping, no write() is needed.  When
+**	BlockTicks rows are staged, they are encoded as one #RecordBlock
+**	into the ring, which overwrites the oldest blocks.  A block is
+**	columnar: first the ms offsets of the updates to the block time,
+**	then the values of sensor 0, 1, ...  Each column is delta encoded,
+**	the first entry relative to 0, as zigzag LEB128 numbers.  Stable
+**	temperatures cost one byte per update.
+**
+**	The file has a fixed size and is preallocated, it never grows.  An
+**	existing file with the same sensors is continued, rows staged before
+**	a crash are encoded at the next start.
+*/
+typedef struct _record_header_
+{
+    uint32_t Magic;			///< #RECORD_MAGIC
+    uint16_t Version;			///< #RECORD_VERSION
+    uint16_t HeaderSize;		///< size of header, names follow
+    uint32_t N;				///< number of sensors
+    uint32_t NameSize;			///< size of one name (0 terminated)
+    uint32_t BlockTicks;		///< updates per block
+    uint32_t Rate;			///< update rate in ms at start
+    uint32_t Seq;			///< seqlock, odd while writing
+    uint32_t Staged;			///< updates in the staging area
+    uint64_t StageTime;			///< CLOCK_REALTIME ns of first staged
+    uint64_t StageUpdate;		///< update number of first staged
+    uint64_t RingOffset;		///< file offset of the ring
+    uint64_t RingSize;			///< size of the ring in bytes
+    uint64_t Head;			///< ring offset of the next block
+    uint64_t Tail;			///< ring offset of the oldest block
+    uint64_t Blocks;			///< number of blocks in the ring
+    uint64_t Updates;			///< number of recorded updates
+} RecordHeader;
+
+/**
+**	Encoded block of updates in the ring.
+**
+**	A block with 0 ticks marks the wrap to the ring start, also the end
+**	of the ring, if there is no room for a block header.
+*/
+typedef struct _record_block_
+{
+    uint64_t Time;			///< CLOCK_REALTIME ns of first update
+    uint64_t Update;			///< update number of first update
+    uint32_t Ticks;			///< number of updates, 0 wrap
+    uint32_t Size;			///< size of the encoded columns
+} RecordBlock;
+
+#define RECORD_MAGIC 0x7232636D		///< "mc2r"
+#define RECORD_VERSION 1		///< layout version
+#define RECORD_NAME_SIZE 128		///< size of a name
+#define RECORD_BLOCK_TICKS 64		///< updates per block
+#define RECORD_SIZE 4096		///< default file size in KiB
+
+static RecordHeader *Record;		///< mapped record, NULL if none
+static size_t RecordFileSize;		///< size of mapped record
+
+    /// names of the recorded sensors
+#define RecordNames(record) \
+    ((char (*)[RECORD_NAME_SIZE])((char *)(record) + (record)->HeaderSize))
+    /// ms offsets of the staged updates
+#define RecordStageMs(record) \
+    ((uint32_t *)((char *)(record) + (record)->HeaderSize \
+	+ (record)->N * (record)->NameSize))
+    /// values of the staged updates, one row per update
+#define RecordStageValues(record) \
+    ((int32_t *)(RecordStageMs(record) + (record)->BlockTicks))
+    /// block at ring offset
+#define RecordBlockAt(record, offset) \
+    ((RecordBlock *)((char *)(record) + (record)->RingOffset + (offset)))
+
+/**
+**	Size of the encoded columns, if all numbers have 5 bytes.
+**
+**	@param n	number of sensors
+**	@param ticks	number of updates
+*/
+static size_t RecordBlockMax(unsigned n, unsigned ticks)
+{
+    return (sizeof(RecordBlock) + (n + 1UL) * ticks * 5 + 7) & ~7UL;
+}
+
+/**
+**	Encode one column delta encoded as zigzag LEB128 numbers.
+**
+**	@param out	output buffer, 5 bytes per number are enough
+**	@param column	first number of the column
+**	@param stride	numbers between two column entries
+**	@param n	number of column entries
+**
+**	@returns pointer behind the encoded column.
+*/
+static uint8_t *RecordEncode(uint8_t * out, const int32_t * column,
+    unsigned stride, unsigned n)
+{
+    uint32_t zigzag;
+    int32_t last;
+    unsigned i;
+
+    last = 0;
+    for (i = 0; i < n; ++i) {
+	// wraps like the unsigned math of the decoder
+	zigzag = (uint32_t) * column - (uint32_t) last;
+	last = *column;
+	column += stride;
+	zigzag = (zigzag << 1) ^ -(zigzag >> 31);
+	while (zigzag >= 0x80) {
+	    *out++ = zigzag | 0x80;
+	    zigzag >>= 7;
+	}
+	*out++ = zigzag;
+    }
+    return out;
+}
+
+/**
+**	Decode one delta encoded column.
+**
+**	@param in	encoded column
+**	@param end	end of the encoded block
+**	@param[out] column	first number of the column
+**	@param stride	numbers between two column entries
+**	@param n	number of column entries
+**
+**	@returns pointer behind the column, NULL if the block is corrupt.
+*/
+static const uint8_t *RecordDecode(const uint8_t * in, const uint8_t * end,
+    int32_t * column, unsigned stride, unsigned n)
+{
+    uint32_t zigzag;
+    uint32_t last;
+    unsigned shift;
+    unsigned i;
+
+    last = 0;
+    for (i = 0; i < n; ++i) {
+	zigzag = 0;
+	shift = 0;
+	do {
+	    if (in >= end || shift > 28) {
+		return NULL;
+	    }
+	    zigzag |= (uint32_t) (*in & 0x7F) << shift;
+	    shift += 7;
+	} while (*in++ & 0x80);
+	last += (zigzag >> 1) ^ -(zigzag & 1);
+	*column = last;
+	column += stride;
+    }
+    return in;
+}
+
+/**
+**	Offset of the block following a block in the ring.
+**
+**	@param offset	ring offset of a block
+*/
+static uint64_t RecordNext(uint64_t offset)
+{
+    const RecordBlock *block;
+
+    block = RecordBlockAt(Record, offset);
+    offset += (sizeof(*block) + block->Size + 7) & ~7UL;
+    if (offset + sizeof(*block) > Record->RingSize
+	|| !RecordBlockAt(Record, offset)->Ticks) {
+	return 0;			// wrap to ring start
+    }
+    return offset;
+}
+
+/**
+**	Drop the oldest blocks, which are in the ring area to overwrite.
+**
+**	@param offset	ring offset of the area
+**	@param size	size of the area
+*/
+static void RecordFree(uint64_t offset, uint64_t size)
+{
+    while (Record->Blocks && Record->Tail >= offset
+	&& Record->Tail < offset + size) {
+	Record->Tail = --Record->Blocks ? RecordNext(Record->Tail) : 0;
+    }
+}
+
+/**
+**	Encode the staged updates as one block into the ring.
+*/
+static void RecordFlush(void)
+{
+    RecordBlock *block;
+    uint8_t *out;
+    uint64_t size;
+    unsigned ticks;
+    unsigned i;
+
+    ticks = Record->Staged;
+    if (!ticks) {
+	return;
+    }
+    size = RecordBlockMax(Record->N, ticks);
+    __atomic_store_n(&Record->Seq, Record->Seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if (Record->Head + size > Record->RingSize) {
+	// no room for the largest block, wrap to the ring start
+	RecordFree(Record->Head, Record->RingSize - Record->Head);
+	if (Record->Head + sizeof(*block) <= Record->RingSize) {
+	    RecordBlockAt(Record, Record->Head)->Ticks = 0;
+	}
+	Record->Head = 0;
+    }
+    RecordFree(Record->Head, size);
+
+    block = RecordBlockAt(Record, Record->Head);
+    out = (uint8_t *) (block + 1);
+    out = RecordEncode(out, (int32_t *) RecordStageMs(Record), 1, ticks);
+    for (i = 0; i < Record->N; ++i) {
+	out = RecordEncode(out, RecordStageValues(Record) + i, Record->N,
+	    ticks);
+    }
+    block->Time = Record->StageTime;
+    block->Update = Record->StageUpdate;
+    block->Size = out - (uint8_t *) (block + 1);
+    block->Ticks = ticks;
+
+    if (!Record->Blocks++) {
+	Record->Tail = Record->Head;
+    }
+    Record->Head += (sizeof(*block) + block->Size + 7) & ~7UL;
+    Record->Staged = 0;
+    __atomic_store_n(&Record->Seq, Record->Seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+**	Write the sensor names into the record.
+**
+**	Called at setup and after hotplug, from the sampler thread.  The
+**	names are those of the last hotplug, also for older blocks.
+*/
+static void RecordRename(void)
+{
+    int i;
+
+    if (!Record) {
+	return;
+    }
+    for (i = 0; i < SensorN; ++i) {
+	strncpy(RecordNames(Record)[i], Sensors[i].Name,
+	    RECORD_NAME_SIZE - 1);
+    }
+}
+
+/**
+**	Record the sampled values.
+**
+**	The hot path only stores into the mapping, every #RECORD_BLOCK_TICKS
+**	updates a block is encoded.
+*/
+static void RecordPublish(void)
+{
+    struct timespec ts;
+    uint64_t now;
+    int32_t *values;
+    unsigned staged;
+    int i;
+
+    if (!Record) {
+	return;
+    }
+    clock_gettime(CLOCK_REALTIME, &ts);
+    now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    staged = Record->Staged;
+    // ms offsets must fit, also after a clock step
+    if (staged && (now < Record->StageTime
+	    || now - Record->StageTime >= 1000000000ULL * 3600 * 24)) {
+	RecordFlush();
+	staged = 0;
+    }
+    if (!staged) {
+	Record->StageTime = now;
+	Record->StageUpdate = Record->Updates;
+    }
+    RecordStageMs(Record)[staged] = (now - Record->StageTime) / 1000000;
+    values = RecordStageValues(Record) + staged * Record->N;
+    for (i = 0; i < SensorN; ++i) {
+	values[i] = Sensors[i].Value;
+    }
+    Record->Updates++;
+    Record->Staged = ++staged;
+    if (staged == Record->BlockTicks) {
+	RecordFlush();
+    }
+}
+
+/**
+**	Check if a record file holds the samples of our sensors.
+**
+**	@param fd	opened record file with a valid header
+**
+**	@returns true if all sensor names are equal.
+*/
+static int RecordSameSensors(int fd)
+{
+    char name[RECORD_NAME_SIZE];
+    int i;
+
+    for (i = 0; i < SensorN; ++i) {
+	if (pread(fd, name, sizeof(name),
+		sizeof(RecordHeader) + i * sizeof(name)) != sizeof(name)
+	    || strncmp(name, Sensors[i].Name, sizeof(name) - 1)) {
+	    return 0;
+	}
+    }
+    return 1;
+}
+
+/**
+**	Map the record file, create or continue it.
+**
+**	@param name	file name, with optional ":size" in KiB
+**
+**	@returns 0 on success, -1 on failure.
+*/
+static int RecordSetup(const char *name)
+{
+    RecordHeader *record;
+    RecordHeader header;
+    struct stat st;
+    char *file;
+    char *s;
+    size_t size;
+    size_t offset;
+    int fd;
+    int err;
+
+    file = strcpy(alloca(strlen(name) + 1), name);
+    size = RECORD_SIZE;
+    if ((s = strrchr(file, ':'))) {
+	*s++ = '\0';
+	size = strtoul(s, NULL, 0);
+    }
+    size *= 1024;
+    offset = sizeof(*record) + SensorN * (RECORD_NAME_SIZE
+	+ RECORD_BLOCK_TICKS * sizeof(int32_t))
+	+ RECORD_BLOCK_TICKS * sizeof(uint32_t);
+    offset = (offset + 7) & ~7UL;
+    if (size < offset + 2 * RecordBlockMax(SensorN, RECORD_BLOCK_TICKS)) {
+	fprintf(stderr, "Record file '%s' is too small, needs %zu KiB\n",
+	    file, (offset + 2 * RecordBlockMax(SensorN,
+		    RECORD_BLOCK_TICKS) + 1023) / 1024);
+	return -1;
+    }
+
+    if ((fd = open(file, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0) {
+	fprintf(stderr, "Can't open record file '%s': %s\n", file,
+	    strerror(errno));
+	return -1;
+    }
+    // continue a record with the same layout
+    if (fstat(fd, &st) || (size_t) st.st_size != size
+	|| pread(fd, &header, sizeof(header), 0) != sizeof(header)
+	|| header.Magic != RECORD_MAGIC || header.Version != RECORD_VERSION
+	|| header.N != (unsigned)SensorN
+	|| header.RingOffset != offset
+	|| header.BlockTicks != RECORD_BLOCK_TICKS
+	|| header.Staged > RECORD_BLOCK_TICKS
+	|| header.Head >= size - offset || header.Tail >= size - offset
+	|| !RecordSameSensors(fd)) {
+	header.Magic = 0;
+	if (ftruncate(fd, 0) || ftruncate(fd, size)) {
+	    fprintf(stderr, "Can't resize record file '%s': %s\n", file,
+		strerror(errno));
+	    close(fd);
+	    return -1;
+	}
+    }
+    // allocate all disk blocks now, a full disk can't fault the mapping
+    if ((err = posix_fallocate(fd, 0, size))) {
+	fprintf(stderr, "Can't allocate record file '%s': %s\n", file,
+	    strerror(err));
+	close(fd);
+	return -1;
+    }
+    if ((record = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		0)) == MAP_FAILED) {
+	fprintf(stderr, "Can't map record file '%s': %s\n", file,
+	    strerror(errno));
+	close(fd);
+	return -1;
+    }
+    close(fd);
+
+    if (!header.Magic) {		// zeroed by ftruncate
+	record->Version = RECORD_VERSION;
+	record->HeaderSize = sizeof(*record);
+	record->N = SensorN;
+	record->NameSize = RECORD_NAME_SIZE;
+	record->BlockTicks = RECORD_BLOCK_TICKS;
+	record->RingOffset = offset;
+	record->RingSize = size - offset;
+	record->Magic = RECORD_MAGIC;
+    }
+    record->Rate = Rate;
+
+    Record = record;
+    RecordFileSize = size;
+    RecordFlush();			// updates staged before a crash
+    RecordRename();
+    if (Verbose) {
+	printf("record %s: %llu blocks, %llu updates\n", file,
+	    (unsigned long long)Record->Blocks,
+	    (unsigned long long)Record->Updates);
+    }
+    return 0;
+}
+
+/**
+**	Encode the staged updates and unmap the record.
+*/
+static void RecordExit(void)
+{
+    if (Record) {
+	RecordFlush();
+	munmap(Record, RecordFileSize);
+	Record = NULL;
+    }
+}
+
+/**
+**	Recorded updates, decoded from a record file.
+*/
+typedef struct _trace_
+{
+    unsigned N;				///< number of sensors
+    unsigned Rate;			///< update rate in ms at start
+    uint64_t Ticks;			///< number of updates
+    uint64_t Bytes;			///< size of the encoded blocks
+    uint64_t *Times;			///< CLOCK_REALTIME ns of each update
+    int32_t *Values;			///< values, one row per update
+    char (*Names)[RECORD_NAME_SIZE];	///< sensor names
+} Trace;
+
+/**
+**	Decode all updates of a record file.
+**
+**	@param name		record file name
+**	@param[out] trace	decoded updates, oldest first
+**
+**	@returns 0 on success, -1 on failure.
+*/
+static int RecordLoad(const char *name, Trace * trace)
+{
+    const RecordHeader *record;
+    const RecordBlock *block;
+    const uint8_t *in;
+    const uint8_t *end;
+    struct stat st;
+    int32_t *ms;
+    int32_t *values;
+    uint64_t offset;
+    uint64_t max;
+    uint64_t i;
+    unsigned j;
+    unsigned k;
+    int fd;
+
+    if ((fd = open(name, O_RDONLY | O_CLOEXEC)) < 0) {
+	fprintf(stderr, "Can't open record file '%s': %s\n", name,
+	    strerror(errno));
+	return -1;
+    }
+    if (fstat(fd, &st) || st.st_size < (off_t) sizeof(*record)
+	|| (record =
+	    mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd,
+		0)) == MAP_FAILED) {
+	fprintf(stderr, "Can't map record file '%s'\n", name);
+	close(fd);
+	return -1;
+    }
+    close(fd);
+    // all sizes are from the file, bound them before any multiplication
+    if (record->Magic != RECORD_MAGIC || record->Version != RECORD_VERSION
+	|| record->HeaderSize < sizeof(*record)
+	|| record->NameSize != RECORD_NAME_SIZE
+	|| record->N > (uint64_t) st.st_size / RECORD_NAME_SIZE
+	|| !record->BlockTicks || record->BlockTicks > 65536
+	|| record->Staged > record->BlockTicks
+	|| record->RingOffset > (uint64_t) st.st_size
+	|| record->RingSize != st.st_size - record->RingOffset
+	|| record->RingOffset < record->HeaderSize
+	+ record->N * (uint64_t) (record->NameSize
+	    + record->BlockTicks * sizeof(int32_t))
+	+ record->BlockTicks * sizeof(uint32_t)
+	|| record->Head >= record->RingSize || record->Tail >= record->RingSize
+	|| record->Blocks > record->RingSize / sizeof(*block)) {
+	fprintf(stderr, "Unsupported record file layout '%s'\n", name);
+	munmap((void *)record, st.st_size);
+	return -1;
+    }
+    // each encoded number has at least one byte, this bounds the updates
+    max = record->RingSize / (record->N + 1) + record->BlockTicks;
+
+    trace->N = record->N;
+    trace->Rate = record->Rate;
+    trace->Ticks = 0;
+    trace->Bytes = 0;
+    trace->Names = malloc(record->N * sizeof(*trace->Names));
+    trace->Times = malloc(max * sizeof(*trace->Times));
+    trace->Values = malloc(max * record->N * sizeof(*trace->Values));
+    ms = malloc(record->BlockTicks * sizeof(*ms));
+    if (!trace->Names || !trace->Times || !trace->Values || !ms) {
+	fprintf(stderr, "out of memory\n");
+	abort();
+    }
+    memcpy(trace->Names, RecordNames(record),
+	record->N * sizeof(*trace->Names));
+    for (j = 0; j < record->N; ++j) {
+	trace->Names[j][RECORD_NAME_SIZE - 1] = '\0';
+    }
+
+    offset = record->Tail;
+    for (i = 0; i < record->Blocks; ++i) {
+	values = trace->Values + trace->Ticks * record->N;
+	in = NULL;
+	block = NULL;
+	// check the bounds, before the block is touched
+	if (offset + sizeof(*block) <= record->RingSize) {
+	    block = RecordBlockAt(record, offset);
+	    if (block->Size <= record->RingSize - offset - sizeof(*block)
+		&& block->Ticks <= record->BlockTicks
+		&& trace->Ticks + block->Ticks <= max - record->BlockTicks) {
+		in = (const uint8_t *)(block + 1);
+		end = in + block->Size;
+		in = RecordDecode(in, end, ms, 1, block->Ticks);
+	    }
+	}
+	for (j = 0; j < record->N && in; ++j) {
+	    in = RecordDecode(in, end, values + j, record->N, block->Ticks);
+	}
+	if (!in) {
+	    fprintf(stderr, "Corrupt record block at %llu\n",
+		(unsigned long long)offset);
+	    break;
+	}
+	for (k = 0; k < block->Ticks; ++k) {
+	    trace->Times[trace->Ticks++] =
+		block->Time + (uint32_t) ms[k] * 1000000ULL;
+	}
+	trace->Bytes += block->Size;
+	offset += (sizeof(*block) + block->Size + 7) & ~7UL;
+	if (offset + sizeof(*block) > record->RingSize
+	    || !RecordBlockAt(record, offset)->Ticks) {
+	    offset = 0;
+	}
+    }
+    // updates not yet encoded
+    memcpy(trace->Values + trace->Ticks * record->N,
+	RecordStageValues(record),
+	record->Staged * record->N * sizeof(*trace->Values));
+    for (k = 0; k < record->Staged; ++k) {
+	trace->Times[trace->Ticks++] =
+	    record->StageTime + RecordStageMs(record)[k] * 1000000ULL;
+    }
+
+    free(ms);
+    munmap((void *)record, st.st_size);
+    return 0;
+}
+
+/**
+**	Free the decoded updates.
+**
+**	@param trace	decoded updates
+*/
+static void TraceFree(Trace * trace)
+{
+    free(trace->Names);
+    free(trace->Times);
+    free(trace->Values);
+    trace->Names = NULL;
+    trace->Times = NULL;
+    trace->Values = NULL;
+}
+
+/**
+**	Reference reader of the record file.
+**
+**	@param name	record file name
+**
+**	@returns 0 on success, -1 on failure.
+**
+**	Prints the sensor names and one line per recorded update: the
+**	time and the values of all sensors.
+*/
+static int RecordRead(const char *name)
+{
+    Trace trace;
+    uint64_t i;
+    unsigned j;
+
+    if (RecordLoad(name, &trace)) {
+	return -1;
+    }
+    printf("# version %u, %u sensors, %u ms rate, %llu updates\n",
+	RECORD_VERSION, trace.N, trace.Rate,
+	(unsigned long long)trace.Ticks);
+    for (j = 0; j < trace.N; ++j) {
+	printf("# %s\n", trace.Names[j]);
+    }
+    for (i = 0; i < trace.Ticks; ++i) {
+	printf("%llu.%03llu",
+	    (unsigned long long)trace.Times[i] / 1000000000,
+	    (unsigned long long)trace.Times[i] / 1000000 % 1000);
+	for (j = 0; j < trace.N; ++j) {
+	    printf(" %d", trace.Values[i * trace.N + j]);
+	}
+	printf("\n");
+    }
+    if (trace.Bytes) {
+	printf("# %.2f bytes per update\n",
+	    (double)trace.Bytes / (trace.Ticks ? : 1));
+    }
+    TraceFree(&trace);
+    return 0;
+}
+
+/**
+**	Replay a record instead of sampling the sensors.
+**
+**	The recorded values are mapped by sensor name, if not all sensors
+**	are in the record and the number of sensors is the same, by
+**	position (same options on another machine).  At the original
+**	cadence the update rate follows the recorded times, the end of the
+**	record ends the event loop.  As fast as possible the updates are
+**	run like the benchmark and the record is repeated.
+*/
+static Trace Replay;			///< decoded record to replay
+static int *ReplayMap;			///< record column of each sensor
+static uint64_t ReplayTick;		///< next update to replay
+
+/**
+**	Load the record to replay and map the sensors.
+**
+**	@returns 0 on success, -1 on failure.
+*/
+static int ReplaySetup(void)
+{
+    char *file;
+    char *s;
+    unsigned j;
+    int mapped;
+    int i;
+
+    file = strcpy(alloca(strlen(ReplayName) + 1), ReplayName);
+    if ((s = strrchr(file, ':')) && !strcmp(s, ":f")) {
+	*s = '\0';
+	ReplayFast = 1;
+    }
+    if (RecordLoad(file, &Replay)) {
+	return -1;
+    }
+    if (!Replay.Ticks) {
+	fprintf(stderr, "No updates recorded in '%s'\n", file);
+	return -1;
+    }
+    ReplayMap = malloc(SensorN * sizeof(*ReplayMap));
+    if (!ReplayMap) {
+	fprintf(stderr, "out of memory\n");
+	abort();
+    }
+    mapped = 0;
+    for (i = 0; i < SensorN; ++i) {
+	ReplayMap[i] = -1;
+	for (j = 0; j < Replay.N; ++j) {
+	    if (!strcmp(Sensors[i].Name, Replay.Names[j])) {
+		ReplayMap[i] = j;
+		++mapped;
+		break;
+	    }
+	}
+    }
+    if (mapped < SensorN) {
+	if ((unsigned)SensorN != Replay.N) {
+	    fprintf(stderr, "Record '%s' has %u sensors, not the %d sensors "
+		"of these options\n", file, Replay.N, SensorN);
+	    return -1;
+	}
+	for (i = 0; i < SensorN; ++i) {
+	    ReplayMap[i] = i;
+	}
+    }
+    if (Verbose) {
+	printf("replay %llu updates, sensors mapped by %s\n",
+	    (unsigned long long)Replay.Ticks,
+	    mapped < SensorN ? "position" : "name");
+    }
+    RateMax = 0;			// the record gives the rate
+    if (Replay.Rate) {
+	Rate = Replay.Rate;
+    }
+    return 0;
+}
+
+/**
+**	Take the values of the next recorded update.
+**
+**	@returns always 0, no sensor is timed.
+*/
+static int ReplaySample(void)
+{
+    const int32_t *values;
+    int rate;
+    int i;
+
+    if (ReplayTick >= Replay.Ticks) {
+	if (!ReplayFast) {		// done, last update was shown
+	    __atomic_store_n(&ReplayDone, 1, __ATOMIC_RELEASE);
+	    return 0;
+	}
+	ReplayTick = 0;
+    }
+    values = Replay.Values + ReplayTick * Replay.N;
+    for (i = 0; i < SensorN; ++i) {
+	Sensors[i].Value = ReplayMap[i] < 0 ? -1 : values[ReplayMap[i]];
+    }
+    ++ReplayTick;
+    if (!ReplayFast) {
+	// wait as long as recorded for the next update
+	rate = Rate;
+	if (ReplayTick < Replay.Ticks) {
+	    rate = (Replay.Times[ReplayTick] - Replay.Times[ReplayTick - 1])
+		/ 1000000;
+	    if (rate < 1) {
+		rate = 1;
+	    }
+	}
+	__atomic_store_n(&RateNext, rate, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+/**
+**	Sample the sensors and publish them.
+*/
+static void SamplerTick(void)
+{
+    unsigned syscalls;
+    uint64_t start;
+    int timed;
+
+    syscalls = SensorSyscalls;
+    start = NowNs();
+    if (ReplayName) {
+	timed = ReplaySample();
+    } else {
+	timed = SensorSample();
+#ifdef EFFECTIVE_FREQ
+	EffectiveSample();
+#endif
+    }
+    HistogramAdd(&SampleHistogram, NowNs() - start);
+    syscalls = SensorSyscalls - syscalls;
+    SnapshotPublish();
+    ExportPublish();
+    RecordPublish();
+
+#ifdef IO_URING
+    if (timed && Uring.FD >= 0) {	// pread probe, not the normal cost
+	return;
+    }
+#else
+    (void)timed;
+#endif
+    if (Verbose && syscalls != TickSyscalls) {
+	printf("%u sensor syscalls per update\n", syscalls);
+	fflush(stdout);
+    }
+    TickSyscalls = syscalls;
+}
+
+#define RATE_MOVING 1000		///< adaptive: 1 degree Celsius change
+
+/**
+**	Adapt the update rate to the temperature changes.
+**
+**	@param alarm	sample was triggered by an alarm
+**
+**	While any temperature moves by a degree or more between two
+**	samples, the interval is halved, after an alarm or a step of four
+**	degrees the fastest rate is used.  While all are stable, the
+**	interval grows by a quarter upto the slowest rate.
+*/
+static void RateAdapt(int alarm)
+{
+    int delta;
+    int rate;
+    int i;
+
+    if (!RateMax) {			// fixed rate
+	return;
+    }
+    delta = 0;
+    for (i = 0; i < SensorN; ++i) {
+	if (Sensors[i].Temperature) {
+	    if (Sensors[i].Value >= 0 && Sensors[i].Last >= 0
+		&& abs(Sensors[i].Value - Sensors[i].Last) > delta) {
+		delta = abs(Sensors[i].Value - Sensors[i].Last);
+	    }
+	    Sensors[i].Last = Sensors[i].Value;
+	}
+    }
+
+    rate = RateNext;
+    if (alarm || delta >= 4 * RATE_MOVING) {
+	rate = RateMin;
+    } else if (delta >= RATE_MOVING) {
+	rate /= 2;
+    } else {
+	rate += rate / 4 + 1;
+    }
+    if (rate < RateMin) {
+	rate = RateMin;
+    } else if (rate > RateMax) {
+	rate = RateMax;
+    }
+    __atomic_store_n(&RateNext, rate, __ATOMIC_RELAXED);
+}
+
+/**
+**	Timeout until the next update of the timer.
+**
+**	@param[out] timeout	buffer for the timeout
+**
+**	@returns ppoll timeout, NULL while the timer is stopped.
+**
+**	The timer runs on an absolute CLOCK_MONOTONIC schedule, event
+**	processing and update time doesn't add drift.  It is a ppoll
+**	timeout and not a timerfd, because only poll honors the timer
+**	slack (-T), which lets the kernel batch our wakeups with others.
+*/
+static const struct timespec *TimerTimeout(struct timespec *timeout)
+{
+    uint64_t now;
+    uint64_t wait;
+    int64_t request;
+
+    request = __atomic_exchange_n(&TimerRequest, -1, __ATOMIC_ACQUIRE);
+    if (request >= 0) {
+	TimerInterval = request / 2 * 1000000ULL;
+	TimerNext = NowNs() + (request & 1 ? 0 : TimerInterval);
+    }
+    if (!TimerInterval) {
+	return NULL;
+    }
+    now = NowNs();
+    wait = TimerNext > now ? TimerNext - now : 0;
+    timeout->tv_sec = wait / 1000000000;
+    timeout->tv_nsec = wait % 1000000000;
+    return timeout;
+}
+
+/**
+**	Check if an update of the timer is due.
+**
+**	@returns true if the update is due, missed updates are coalesced.
+*/
+static int TimerExpired(void)
+{
+    uint64_t now;
+    uint64_t expirations;
+
+    now = NowNs();
+    if (!TimerInterval || now < TimerNext) {
+	return 0;
+    }
+    expirations = 1 + (now - TimerNext) / TimerInterval;
+    // lateness of the last expiration
+    TimerNext += (expirations - 1) * TimerInterval;
+    HistogramAdd(&LatenessHistogram, now - TimerNext);
+    TimerNext += TimerInterval;
+    // coalesce missed ticks, only one update
+    MissedTicks += expirations - 1;
+    return 1;
+}
+
+/**
+**	Sampler thread.
+**
+**	Waits for the update timer or an alarm, samples all sensors and
+**	tells the X11 thread, that a new snapshot is available.  A slow
+**	sensor read didn't block the X11 event handling.
+**
+**	@param dummy	unused thread argument
+*/
+static void *Sampler(void *dummy)
+{
+    struct timespec timeout;
+    uint64_t wakeups;
+    uint64_t one;
+    int expired;
+    int alarm;
+
+    (void)dummy;
+    one = 1;
+    while (!__atomic_load_n(&SamplerQuit, __ATOMIC_ACQUIRE)) {
+	// alarm slots are rebuild on hotplug
+	Alarms[0].fd = TimerFD;
+	Alarms[0].events = POLLIN;
+	Alarms[1].fd = UeventFD;	// ignored, if -1
+	Alarms[1].events = POLLIN;
+	if (ppoll(Alarms, 2 + AlarmN, TimerTimeout(&timeout), NULL) < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    break;
+	}
+	alarm = AlarmRead();
+	if (Alarms[1].revents & POLLIN) {
+	    int events;
+
+	    events = UeventRead();
+	    if (events & UEVENT_HOTPLUG) {
+		// cpu or hwmon hotplug, the only time we scan directories
+		SensorRebuild();
+		ExportRename();
+		RecordRename();
+	    }
+	    alarm |= events & UEVENT_ALARM;
+	}
+	if (Alarms[0].revents & POLLIN) {	// re-armed, see TimerArm
+	    if (read(TimerFD, &wakeups, sizeof(wakeups)) != sizeof(wakeups)
+		&& errno != EINTR && errno != EAGAIN) {
+		break;
+	    }
+	}
+	expired = TimerExpired();
+	if (alarm) {			// sample now, don't wait for the timer
+	    ++AlarmCount;
+	} else if (!expired) {
+	    continue;
+	}
+	SamplerTick();
+	RateAdapt(alarm);
+	if (write(SampleFD, &one, sizeof(one)) != sizeof(one)
+	    || __atomic_load_n(&ReplayDone, __ATOMIC_ACQUIRE)) {
+	    break;			// the event loop ends with the replay
+	}
+    }
+    return NULL;
+}
+
+/**
+**	Start the sampler thread.
+**
+**	The first snapshot is sampled synchronously, it is ready for the
+**	first draw.
+**
+**	@returns 0 on success, -1 on failure.
+*/
+static int SamplerStart(void)
+{
+    Snapshot.N = SensorN;
+    Snapshot.Values = calloc(SensorN + 1, sizeof(*Snapshot.Values));
+    Values = calloc(SensorN + 1, sizeof(*Values));
+    History = malloc((SensorN + 1) * HISTORY_SIZE * sizeof(*History));
+    SensorHistograms = calloc(SensorN + 1, sizeof(*SensorHistograms));
+    if (!Snapshot.Values || !Values || !History || !SensorHistograms) {
+	fprintf(stderr, "out of memory\n");
+	return -1;
+    }
+    RateNext = Rate;
+    SamplerTick();
+    if (BenchTicks) {			// benchmark samples synchronously
+	return 0;
+    }
+
+    TimerFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    SampleFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (TimerFD < 0 || SampleFD < 0) {
+	fprintf(stderr, "Can't create timer\n");
+	return -1;
+    }
+    // let the kernel batch our wakeups with others
+    prctl(PR_SET_TIMERSLACK, TimerSlack * 1000UL, 0, 0, 0);
+    TimerArm(Rate, 0);			// default 1500ms delay between updates
+
+    if (pthread_create(&SamplerThread, NULL, Sampler, NULL)) {
+	fprintf(stderr, "Can't create sampler thread\n");
+	return -1;
+    }
+    return 0;
+}
+
+/**
+**	Stop the sampler thread.
+**
+**	The thread isn't canceled, it could be in the middle of publishing
+**	a snapshot.  It is woken and ends after its current update.
+*/
+static void SamplerStop(void)
+{
+    if (SampleFD >= 0) {
+	__atomic_store_n(&SamplerQuit, 1, __ATOMIC_RELEASE);
+	TimerArm(0, 0);			// wakes the sampler
+	pthread_join(SamplerThread, NULL);
+	close(SampleFD);
+	SampleFD = -1;
+    }
+    if (TimerFD >= 0) {
+	close(TimerFD);
+	TimerFD = -1;
+    }
+}
+
+/**
+**	Print all latency histograms and the read latency of each sensor.
+**
+**	Called on SIGUSR1 and at exit with -v.  The histograms of the
+**	sampler thread are read unlocked, these are only statistics.  The
+**	sensor names are locked, a hotplug rebuild replaces them.
+*/
+static void MetricsDump(void)
+{
+    char buf[160];
+    char total[32];
+    const char *s;
+    int i;
+
+    pthread_mutex_lock(&SensorNameLock);
+    printf("update rate %d ms", Rate);
+    if (RateMax) {
+	printf(" (adaptive %d-%d ms)", RateMin, RateMax);
+    }
+    printf(", %u alarms, first frame after %.3f ms\n", AlarmCount,
+	FirstFrameTime / 1e6);
+    if (SuspendCount) {
+	printf("%u suspends, %.3f s suspended\n", SuspendCount,
+	    (SuspendTime + (Suspended ? NowNs() - SuspendStart : 0)) / 1e9);
+    }
+    HistogramPrint("timer lateness", &LatenessHistogram);
+    HistogramPrint("sensor sample", &SampleHistogram);
+    HistogramPrint("render", &RenderHistogram);
+    HistogramPrint("xcb flush", &FlushHistogram);
+    for (i = 0; i < SensorN && Values; ++i) {
+	if ((s = strstr(Sensors[i].Name, "_throttle_count"))) {
+	    // the total time is only needed here, it isn't sampled
+	    snprintf(buf, sizeof(buf), "%.*s_throttle_total_time_ms",
+		(int)(s - Sensors[i].Name), Sensors[i].Name);
+	    if (ReadString(buf, total, sizeof(total)) <= 0) {
+		strcpy(total, "-");
+	    }
+	    printf("%s: %d, total %s ms\n", Sensors[i].Name, Values[i],
+		total);
+	}
+    }
+    for (i = 0; i < SensorN; ++i) {
+	if (!Sensors[i].Virtual) {
+	    HistogramPrint(Sensors[i].Name, SensorHistograms + i);
+	}
+    }
+    fflush(stdout);
+    pthread_mutex_unlock(&SensorNameLock);
+}
+
+/**
+**	Reduce the samples of all cores to minimum, maximum and mean.
+**
+**	@param values		structure of arrays sample buffer
+**	@param n		number of values
+**	@param[out] min		minimum of valid values
+**	@param[out] max		maximum of valid values
+**	@param[out] mean	mean of valid values
+**
+**	@returns index of the (first) maximum, -1 if no value is valid.
+**
+**	Invalid (negative) values are ignored.  The loop is branch free and
+**	uses masks, so that the compiler can vectorize it.
+*/
+static int Reduce(const int *restrict values, int n, int *min, int *max,
+    int *mean)
+{
+    int lo;
+    int hi;
+    int64_t sum;
+    int valid;
+    int i;
+
+    lo = INT_MAX;
+    hi = -1;
+    sum = 0;
+    valid = 0;
+    for (i = 0; i < n; ++i) {
+	int v;
+	int ok;
+	int m;
+
+	v = values[i];
+	ok = -(v >= 0);			// all bits set, if valid
+	m = (v & ok) | (~ok & INT_MAX);
+	lo = m < lo ? m : lo;
+	hi = v > hi ? v : hi;
+	sum += v & ok;
+	valid -= ok;
+    }
+    if (!valid) {
+	*min = *max = *mean = -1;
+	return -1;
+    }
+    *min = lo;
+    *max = hi;
+    *mean = sum / valid;
+
+    for (i = 0; values[i] != hi; ++i) {
+    }
+    return i;
+}
+
+/**
+**	Check if a cpu of the current window throttled since the last update.
+**
+**	@param n	cpu index in the window
+**
+**	@returns true if the core or package throttle count increased.
+*/
+static int ThrottleCheck(int n)
+{
+    int handle;
+    int now;
+    int last;
+    int j;
+
+    if (!Dock->CpuThrottleSensors) {
+	return 0;
+    }
+    for (j = 0; j < 4; ++j) {		// core and package of both cpus
+	if ((handle = Dock->CpuThrottleSensors[n][j]) < 0) {
+	    continue;
+	}
+	now = HistoryGet(handle, 0);
+	last = HistoryGet(handle, 1);
+	if (now >= 0 && last >= 0 && now > last) {
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/**
+**	Check if a frequency is shown in red.
+**
+**	@param freq		frequency in kHz
+**	@param throttled	cpu throttled since the last update
+**
+**	With -u only throttled cpus and the turbo boost frequencies given
+**	with -t are red, else all frequencies >= -t are red.
+*/
+static int SlotRed(int freq, int throttled)
+{
+    if (ThrottleShow) {
+	return throttled || (TurboBoostFreq && freq >= TurboBoostFreq);
+    }
+    return freq >= TurboBoostFreq;
+}
+
+/**
+**	Fill the display slots with the values of the current page of cpus.
+*/
+static void SlotsFillPage(void)
+{
+    int flag;
+    int i;
+    int n;
+
+    flag = Ticks & 1;			// alternate joined cpus
+    for (i = 0; i < Dock->Slots; ++i) {
+	n = (Dock->CpuFirst + i) % Dock->Cpus;
+	SlotTemps[i] = Values[Dock->CpuTempSensors[n]];
+	SlotFreqs[i] = Values[Dock->CpuFreqSensors[n][flag]];
+	SlotTurbo[i] = SlotRed(SlotFreqs[i], ThrottleCheck(n));
+    }
+}
+
+/**
+**	Fill the display slots with the aggregate of all cpus.
+**
+**	Slot 0 shows the maximum, slot 1 the mean and slot 2 the minimum
+**	temperature and frequency.  Slot 3 shows the temperature spread
+**	and the number of the hottest cpu.  The graph shows slot 0 with the
+**	frequency of the hottest cpu.
+*/
+static void SlotsFillAggregate(void)
+{
+    int i;
+    int hottest;
+    int throttled;
+
+    // gather into structure of arrays buffers
+    for (i = 0; i < Dock->Cpus; ++i) {
+	CoreTemps[i] = Values[Dock->CpuTempSensors[i]];
+    }
+    CoreFreqN = 0;
+    for (i = 0; i < Dock->Cpus; ++i) {
+	CoreFreqs[CoreFreqN++] = Values[Dock->CpuFreqSensors[i][0]];
+	if (Dock->JoinFreq) {
+	    CoreFreqs[CoreFreqN++] = Values[Dock->CpuFreqSensors[i][1]];
+	}
+    }
+
+    hottest =
+	Reduce(CoreTemps, Dock->Cpus, SlotTemps + 2, SlotTemps + 0,
+	SlotTemps + 1);
+    Reduce(CoreFreqs, CoreFreqN, SlotFreqs + 2, SlotFreqs + 0, SlotFreqs + 1);
+    throttled = 0;
+    for (i = 0; i < Dock->Cpus && !throttled; ++i) {
+	throttled = ThrottleCheck(i);
+    }
+    for (i = 0; i < 3; ++i) {
+	SlotTurbo[i] = SlotRed(SlotFreqs[i], throttled);
+    }
+
+    SlotTemps[3] = SlotTemps[0] - SlotTemps[2];
+    SlotCpu = hottest < 0 ? 0 : Dock->CpuTempCpus[hottest];
+    SlotTurbo[3] = throttled;
+
+    if (Dock->Graph && hottest >= 0) {	// frequency of the hottest cpu
+	SlotFreqs[0] = Values[Dock->CpuFreqSensors[hottest][Ticks & 1]];
+	SlotTurbo[0] = SlotRed(SlotFreqs[0], ThrottleCheck(hottest));
+    }
+}
+
+/**
+**	Add the latest values of all sensors to their history ring buffers.
+**
+**	@param values	sampled values of all sensors
+*/
+static void HistoryPush(const int *values)
+{
+    int i;
+
+    for (i = 0; i < SensorN; ++i) {
+	History[i * HISTORY_SIZE + HistoryHead] = values[i];
+    }
+    HistoryHead = (HistoryHead + 1) & (HISTORY_SIZE - 1);
+    if (HistoryN < HISTORY_SIZE) {
+	++HistoryN;
+    }
+}
+
+/**
+**	Get an older value of a sensor.
+**
+**	@param handle	sensor handle
+**	@param age	0 is the latest, 1 the one before, ...
+**
+**	@returns the sampled value, -1 if not available.
+*/
+static int HistoryGet(int handle, unsigned age)
+{
+    if (age >= HistoryN) {
+	return -1;
+    }
+    return History[handle * HISTORY_SIZE +
+	((HistoryHead - 1 - age) & (HISTORY_SIZE - 1))];
+}
+
+/**
+**	Get the graph value: the temperature of the hottest cpu.
+**
+**	@param age	0 is the latest, 1 the one before, ...
+*/
+static int GraphValue(unsigned age)
+{
+    int i;
+    int n;
+    int max;
+
+    max = -1;
+    for (i = 0; i < Dock->Cpus; ++i) {
+	n = HistoryGet(Dock->CpuTempSensors[i], age);
+	if (n > max) {
+	    max = n;
+	}
+    }
+    return max;
+}
+
+/**
+**	Convert a graph value to a pixel row.
+**
+**	@param value	temperature
+*/
+static int GraphY(int value)
+{
+    if (value < GRAPH_MIN) {
+	value = GRAPH_MIN;
+    } else if (value > GRAPH_MAX) {
+	value = GRAPH_MAX;
+    }
+    return GRAPH_Y + GRAPH_H - 1 - (value - GRAPH_MIN) * (GRAPH_H - 1)
+	/ (GRAPH_MAX - GRAPH_MIN);
+}
+
+/**
+**	Draw one column of the graph.
+**
+**	@param x	x pixel position of the column
+**	@param age	age of the sample shown in the column
+*/
+static void DrawGraphColumn(int x, unsigned age)
+{
+    int n;
+    int y1;
+    int y2;
+
+    Fill(1, 12, 1, 9, x, GRAPH_Y, 1, GRAPH_H);	// background
+    if ((n = GraphValue(age)) < 0) {
+	return;
+    }
+    y1 = y2 = GraphY(n);
+    if ((n = GraphValue(age + 1)) >= 0) {	// connect to previous sample
+	y2 = GraphY(n);
+	if (y2 < y1) {
+	    n = y1;
+	    y1 = y2;
+	    y2 = n;
+	}
+    }
+    Fill(9, 50, 1, 7, x, y1, 1, y2 - y1 + 1);
+}
+
+/**
+**	Draw the sparkline graph of the hottest cpu.
+**
+**	@param num	unused, the graph is drawn from the history
+**	@param x	unused, the graph is at #GRAPH_X
+**	@param y	unused, the graph is at #GRAPH_Y
+**
+**	Only the newest column is drawn, the older columns are scrolled.
+*/
+static void DrawGraph(unsigned num, int x, int y)
+{
+    int i;
+
+    (void)num;
+    (void)x;
+    (void)y;
+    if (Dock->GraphDirty) {
+	Dock->GraphDirty = 0;
+	for (i = 0; i < GRAPH_W; ++i) {
+	    DrawGraphColumn(GRAPH_X + i, GRAPH_W - 1 - i);
+	}
+	return;
+    }
+    Scroll(GRAPH_X, GRAPH_Y, GRAPH_W, GRAPH_H);
+    DrawGraphColumn(GRAPH_X + GRAPH_W - 1, 0);
+}
+
+/**
+**	Get the value of a thermal zone display slot.
+**
+**	@param slot	display slot 0 or 1
+**
+**	More than two zones are paged through the two slots.
+*/
+static int ZoneValue(int slot)
+{
+    return Values[ZoneSensors[(ZoneFirst + slot) % ThermalZones]];
+}
+
+// ------------------------------------------------------------------------- //
+
+/**
+**	Draw the current values into the current window.
+*/
+static void DockappDraw(void)
+{
+    const DrawCommand *command;
+
+    if (Dock->Graph || Dock->Aggregate) {
+	SlotsFillAggregate();
+    } else {
+	if (Dock->Cpus > Dock->Slots && PageTicks
+	    && ++Dock->Pages >= PageTicks) {
+	    // more cpus than display slots, show next page
+	    Dock->Pages = 0;
+	    Dock->CpuFirst = (Dock->CpuFirst + Dock->Slots) % Dock->Cpus;
+	}
+	SlotsFillPage();
+    }
+    for (command = Dock->Commands; command < Dock->Commands + Dock->CommandN;
+	++command) {
+	if (*command->Value >= command->Min) {
+	    command->Draw[(int)*command->Alt] (*command->Value / command->Div,
+		command->X, command->Y);
+	}
+    }
+}
+
+/**
+**	Timeout call back.
+**
+**	The snapshot is read once, all windows are drawn from it and the
+**	requests of all windows are sent with one flush.
+*/
+void Timeout(void)
+{
+    uint64_t start;
+    uint64_t now;
+    int damaged;
+    int i;
+
+    start = NowNs();
+    //
+    // Update  everything
+    //
+    SnapshotRead(Values);
+    HistoryPush(Values);
+    ++Ticks;
+    if (ThermalZones > 2 && PageTicks && ++ZonePages >= PageTicks) {
+	// more zones than display slots, show next two
+	ZonePages = 0;
+	ZoneFirst = (ZoneFirst + 2) % ThermalZones;
+    }
+    for (i = 0; i < 2 && i < ThermalZones; ++i) {
+	SlotZones[i] = ZoneValue(i);
+    }
+    damaged = 0;
+    for (i = 0; i < DockappN; ++i) {
+	Dock = Dockapps + i;
+	if (Dock->Unmapped || Dock->Obscured) {	// nobody can see it
+	    continue;
+	}
+	DockappDraw();
+	damaged |= FramePut();
+    }
+    now = NowNs();
+    HistogramAdd(&RenderHistogram, now - start);
+    if (!damaged) {			// nothing changed, no X11 requests
+	++SkippedTicks;
+	return;
+    }
+    // flush the request
+    if (Connection) {
+	xcb_flush(Connection);
+	HistogramAdd(&FlushHistogram, NowNs() - now);
+    }
+    if (!FirstFrameTime) {		// connect, setup and first draw
+	FirstFrameTime = NowNs() - StartTime;
+	if (Verbose) {
+	    printf("first frame after %.3f ms\n", FirstFrameTime / 1e6);
+	    fflush(stdout);
+	}
+    }
+}
+
+/**
+**	Layout element kinds.
+*/
+enum _layout_kind_
+{
+    LAYOUT_END,				///< end of layout table
+    LAYOUT_BACKGROUND,			///< blit from atlas
+    LAYOUT_LABEL,			///< cpu0/cpu1 text, hidden otherwise
+    LAYOUT_BOX,				///< blit from atlas, part of the shape
+    LAYOUT_SHAPE,			///< only part of the shape
+    LAYOUT_TEMP,			///< cpu temperature slot
+    LAYOUT_FREQ,			///< cpu frequency slot
+    LAYOUT_ZONE,			///< thermal zone slot
+    LAYOUT_GRAPH,			///< graph of the hottest cpu
+};
+
+/**
+**	Layout element.
+**
+**	A layout is a static table of background blits, shape rectangles
+**	and value slots.  DockappPrepare() draws the background, sets the
+**	shape and compiles the value slots into the draw commands.
+*/
+typedef struct _layout_item_
+{
+    uint8_t Kind;			///< element kind LAYOUT_...
+    uint8_t Slot;			///< value slot of the value kinds
+    uint8_t MinZones;			///< only with at least n thermal zones
+    uint8_t MaxZones;			///< only with at most n thermal zones
+    uint8_t SX;				///< atlas x pixel of background kinds
+    uint8_t SY;				///< atlas y pixel of background kinds
+    uint8_t X;				///< x pixel position
+    uint8_t Y;				///< y pixel position
+    uint8_t W;				///< width of background and shape
+    uint8_t H;				///< height of background and shape
+} LayoutItem;
+
+    /// layout element shortcut macro
+#define L_ITEM(kind, slot, min_zones, max_zones, sx, sy, x, y, w, h) \
+    { kind, slot, min_zones, max_zones, sx, sy, x, y, w, h }
+    /// unconditional background box
+#define L_BOX(sx, sy, x, y, w, h) \
+    L_ITEM(LAYOUT_BOX, 0, 0, ZONE_MAX, sx, sy, x, y, w, h)
+    /// unconditional value slot
+#define L_VALUE(kind, slot, x, y) \
+    L_ITEM(kind, slot, 0, ZONE_MAX, 0, 0, x, y, 0, 0)
+    /// temperature box, the number is drawn at +2,+2
+#define L_TEMP_BOX(x, y) L_BOX(0, 22, x, y, 29, 11)
+    /// frequency box, the number is drawn at +2,+2
+#define L_FREQ_BOX(x, y) L_BOX(0, 11, x, y, 27, 11)
+    /// text box
+#define L_TEXT_BOX(x, y) L_BOX(0, 0, x, y, 26, 11)
+    /// end of layout
+#define L_END L_ITEM(LAYOUT_END, 0, 0, 0, 0, 0, 0, 0, 0, 0)
+
+    /// 1 slot: hottest cpu and the graph
+static const LayoutItem Layout1[] = {
+    L_TEMP_BOX(2, 2),
+    L_FREQ_BOX(2 + 33, 2),
+    L_ITEM(LAYOUT_SHAPE, 0, 0, ZONE_MAX, 0, 0, GRAPH_X, GRAPH_Y, GRAPH_W,
+	GRAPH_H),
+    L_VALUE(LAYOUT_TEMP, 0, 2 + 2, 2 + 2),
+    L_VALUE(LAYOUT_FREQ, 0, 2 + 33 + 2, 2 + 2),
+    L_VALUE(LAYOUT_GRAPH, 0, GRAPH_X, GRAPH_Y),
+    L_END
+};
+
+    /// 2 slots: labeled cpu temperatures, zones, frequencies
+static const LayoutItem Layout2[] = {
+    // text areas and text cpu
+    L_TEXT_BOX(3, 3),
+    L_TEXT_BOX(3, 15 + 3),
+    L_ITEM(LAYOUT_LABEL, 0, 0, ZONE_MAX, 29, 0, 5, 5, 23, 7),
+    L_ITEM(LAYOUT_LABEL, 0, 0, ZONE_MAX, 29, 7, 5, 15 + 5, 23, 7),
+    // temperature cpu
+    L_TEMP_BOX(3 + 29, 3),
+    L_TEMP_BOX(3 + 29, 15 + 3),
+    // frequency
+    L_FREQ_BOX(3, 46 + 3),
+    L_FREQ_BOX(3 + 31, 46 + 3),
+    // text area and text for only 1 zone, temperature area for zone
+    L_ITEM(LAYOUT_BOX, 0, 1, 1, 0, 0, 3, 3 + 30, 26, 11),
+    L_ITEM(LAYOUT_BACKGROUND, 0, 1, 1, 29, 14, 5, 3 + 30 + 2, 23, 7),
+    L_ITEM(LAYOUT_BOX, 0, 2, ZONE_MAX, 0, 22, 3, 3 + 30, 29, 11),
+    // temperature area zone 2 or 1
+    L_ITEM(LAYOUT_BOX, 0, 1, ZONE_MAX, 0, 22, 3 + 29, 3 + 30, 29, 11),
+
+    L_VALUE(LAYOUT_TEMP, 0, 3 + 29 + 2, 3 + 2),
+    L_VALUE(LAYOUT_TEMP, 1, 3 + 29 + 2, 3 + 15 + 2),
+    L_ITEM(LAYOUT_ZONE, 0, 1, 1, 0, 0, 3 + 29 + 2, 3 + 30 + 2, 0, 0),
+    L_ITEM(LAYOUT_ZONE, 0, 2, ZONE_MAX, 0, 0, 3 + 2, 3 + 30 + 2, 0, 0),
+    L_ITEM(LAYOUT_ZONE, 1, 2, ZONE_MAX, 0, 0, 3 + 29 + 2, 3 + 30 + 2, 0, 0),
+    L_VALUE(LAYOUT_FREQ, 0, 3 + 2, 46 + 3 + 2),
+    L_VALUE(LAYOUT_FREQ, 1, 3 + 31 + 2, 46 + 3 + 2),
+    L_END
+};
+
+    /// 4 slots: temperature and frequency rows, zones below
+static const LayoutItem Layout4[] = {
+    L_TEMP_BOX(2, 2),
+    L_TEMP_BOX(2, 12 + 2),
+    L_TEMP_BOX(2, 24 + 2),
+    L_TEMP_BOX(2, 36 + 2),
+    L_ITEM(LAYOUT_BOX, 0, 1, ZONE_MAX, 0, 22, 2, 2 + 49, 29, 11),
+    L_ITEM(LAYOUT_BOX, 0, 2, ZONE_MAX, 0, 22, 2 + 31, 2 + 49, 29, 11),
+    L_FREQ_BOX(2 + 33, 2),
+    L_FREQ_BOX(2 + 33, 12 + 2),
+    L_FREQ_BOX(2 + 33, 24 + 2),
+    L_FREQ_BOX(2 + 33, 36 + 2),
+
+    L_VALUE(LAYOUT_TEMP, 0, 2 + 2, 2 + 2),
+    L_VALUE(LAYOUT_TEMP, 1, 2 + 2, 12 + 2 + 2),
+    L_VALUE(LAYOUT_TEMP, 2, 2 + 2, 24 + 2 + 2),
+    L_VALUE(LAYOUT_TEMP, 3, 2 + 2, 36 + 2 + 2),
+    L_ITEM(LAYOUT_ZONE, 0, 1, ZONE_MAX, 0, 0, 2 + 2, 2 + 49 + 2, 0, 0),
+    L_ITEM(LAYOUT_ZONE, 1, 2, ZONE_MAX, 0, 0, 2 + 31 + 2, 2 + 49 + 2, 0, 0),
+    L_VALUE(LAYOUT_FREQ, 0, 2 + 33 + 2, 2 + 2),
+    L_VALUE(LAYOUT_FREQ, 1, 2 + 33 + 2, 12 + 2 + 2),
+    L_VALUE(LAYOUT_FREQ, 2, 2 + 33 + 2, 24 + 2 + 2),
+    L_VALUE(LAYOUT_FREQ, 3, 2 + 33 + 2, 36 + 2 + 2),
+    L_END
+};
+
+    /// 8 slots: two columns of temperatures, zones below, no frequencies
+static const LayoutItem Layout8[] = {
+    L_TEMP_BOX(2, 2),
+    L_TEMP_BOX(2, 12 + 2),
+    L_TEMP_BOX(2, 24 + 2),
+    L_TEMP_BOX(2, 36 + 2),
+    L_TEMP_BOX(2 + 31, 2),
+    L_TEMP_BOX(2 + 31, 12 + 2),
+    L_TEMP_BOX(2 + 31, 24 + 2),
+    L_TEMP_BOX(2 + 31, 36 + 2),
+    L_ITEM(LAYOUT_BOX, 0, 1, ZONE_MAX, 0, 22, 2, 2 + 49, 29, 11),
+    L_ITEM(LAYOUT_BOX, 0, 2, ZONE_MAX, 0, 22, 2 + 31, 2 + 49, 29, 11),
+
+    L_VALUE(LAYOUT_TEMP, 0, 2 + 2, 2 + 2),
+    L_VALUE(LAYOUT_TEMP, 1, 2 + 2, 12 + 2 + 2),
+    L_VALUE(LAYOUT_TEMP, 2, 2 + 2, 24 + 2 + 2),
+    L_VALUE(LAYOUT_TEMP, 3, 2 + 2, 36 + 2 + 2),
+    L_VALUE(LAYOUT_TEMP, 4, 2 + 31 + 2, 2 + 2),
+    L_VALUE(LAYOUT_TEMP, 5, 2 + 31 + 2, 12 + 2 + 2),
+    L_VALUE(LAYOUT_TEMP, 6, 2 + 31 + 2, 24 + 2 + 2),
+    L_VALUE(LAYOUT_TEMP, 7, 2 + 31 + 2, 36 + 2 + 2),
+    L_ITEM(LAYOUT_ZONE, 0, 1, ZONE_MAX, 0, 0, 2 + 2, 2 + 49 + 2, 0, 0),
+    L_ITEM(LAYOUT_ZONE, 1, 2, ZONE_MAX, 0, 0, 2 + 31 + 2, 2 + 49 + 2, 0, 0),
+    L_END
+};
+
+    /// all layouts by number of slots
+static const struct
+{
+    int Slots;				///< number of cpu slots
+    const LayoutItem *Items;		///< layout table
+} Layouts[] = {
+    {1, Layout1},
+    {2, Layout2},
+    {4, Layout4},
+    {8, Layout8},
+};
+
+static const char LayoutNoAlt;		///< alternative draw never used
+
+/**
+**	Find the layout for a number of slots.
+**
+**	@param slots	number of cpus displayed at once
+**
+**	@returns the layout table, NULL if there is none.
+*/
+static const LayoutItem *LayoutFind(int slots)
+{
+    int i;
+
+    for (i = 0; i < (int)(sizeof(Layouts) / sizeof(*Layouts)); ++i) {
+	if (Layouts[i].Slots == slots) {
+	    return Layouts[i].Items;
+	}
+    }
+    return NULL;
+}
+
+/**
+**	Compile a value slot of the layout into a draw command.
+**
+**	@param item	layout element
+**	@param draw	draw function
+**	@param alt_draw	alternative draw function, used if *alt is true
+**	@param value	bound value slot
+**	@param alt	bound alternative flag
+**	@param min	smaller values aren't drawn
+**	@param div	divisor of value for display
+*/
+static void LayoutCommand(const LayoutItem * item, void (*draw) (unsigned,
+	int, int), void (*alt_draw) (unsigned, int, int), const int *value,
+    const char *alt, int min, int div)
+{
+    DrawCommand *command;
+
+    if (Dock->CommandN >= LAYOUT_MAX) {
+	return;
+    }
+    command = Dock->Commands + Dock->CommandN++;
+    command->Draw[0] = draw;
+    command->Draw[1] = alt_draw;
+    command->Value = value;
+    command->Alt = alt;
+    command->Min = min;
+    command->Div = div;
+    command->X = item->X;
+    command->Y = item->Y;
 }
 
 /**
-**	Draw a number at given cordinates with small font.
+**	Prepare the graphic data of the current window.
 **
-**	@param	num	unsigned number
-**	@param	x	x pixel position
-**	@param	y	y pixel position
+**	Draws the background of the layout, sets the window shape and
+**	compiles the value slots for the configured thermal zones into the
+**	draw commands of the window.
 */
-void DrawSmallNumber(unsigned num, int x, int y)
+static void DockappPrepare(void)
 {
-    int n1000;
-    int n100;
-    int n10;
-    int n1;
+    xcb_rectangle_t rectangles[LAYOUT_MAX];
+    const LayoutItem *item;
+    int len;
 
-    n1 = num % 10;
-    n10 = (num / 10) % 10;
-    n100 = (num / 100) % 10;
-    n1000 = (num / 1000) % 10;
+    Dock->CellN = 0;			// background redrawn, forget cells
+    if (FrameSetup((void *)wmc2d_xpm) && !Image) {
+	// no client side frame buffer, draw on the server
+	Image = CreatePixmap((void *)wmc2d_xpm, NULL);
+    }
+    // clear background
+    Blit(0, 0, 0, 0, 64, 64);
 
-    if (n1000) {
-	xcb_copy_area(Connection, Image, Pixmap, NormalGC, n1000 * 6, 50, x, y,
-	    6, 7);
-    } else {
-	xcb_copy_area(Connection, Image, Pixmap, NormalGC, 2, 2, x, y, 6, 7);
+    len = 0;
+    Dock->CommandN = 0;
+    Dock->GraphDirty = 1;
+    for (item = LayoutFind(Dock->Slots); item->Kind != LAYOUT_END; ++item) {
+	if (ThermalZones < item->MinZones || ThermalZones > item->MaxZones) {
+	    continue;
+	}
+	switch (item->Kind) {
+	    case LAYOUT_LABEL:		// the labels are fixed text
+		if (Dock->StartCpu || Dock->Cpus > Dock->Slots) {
+		    break;
+		}
+		// fall through
+	    case LAYOUT_BACKGROUND:
+		Blit(item->SX, item->SY, item->X, item->Y, item->W, item->H);
+		break;
+	    case LAYOUT_BOX:
+		Blit(item->SX, item->SY, item->X, item->Y, item->W, item->H);
+		// fall through
+	    case LAYOUT_SHAPE:
+		if (len < LAYOUT_MAX) {
+		    rectangles[len].x = item->X;
+		    rectangles[len].y = item->Y;
+		    rectangles[len].width = item->W;
+		    rectangles[len].height = item->H;
+		    ++len;
+		}
+		break;
+	    case LAYOUT_TEMP:
+		LayoutCommand(item, DrawLcdNumber, DrawLcdNumber,
+		    SlotTemps + item->Slot, &LayoutNoAlt, INT_MIN, 100);
+		break;
+	    case LAYOUT_FREQ:
+		if (Dock->Aggregate && item->Slot == 3) {
+		    // aggregate shows the hottest cpu instead of a frequency
+		    LayoutCommand(item, DrawSmallNumber, DrawRedSmallNumber,
+			&SlotCpu, SlotTurbo + 3, INT_MIN, 1);
+		    break;
+		}
+		LayoutCommand(item, DrawSmallNumber, DrawRedSmallNumber,
+		    SlotFreqs + item->Slot, SlotTurbo + item->Slot, INT_MIN,
+		    1000);
+		break;
+	    case LAYOUT_ZONE:		// unreadable zones keep the old value
+		LayoutCommand(item, DrawLcdNumber, DrawLcdNumber,
+		    SlotZones + item->Slot, &LayoutNoAlt, 0, 100);
+		break;
+	    case LAYOUT_GRAPH:
+		LayoutCommand(item, DrawGraph, DrawGraph, SlotTemps,
+		    &LayoutNoAlt, INT_MIN, 1);
+		break;
+	}
     }
-    x += 6;
 
-    if (n1000 || n100) {
-	xcb_copy_area(Connection, Image, Pixmap, NormalGC, n100 * 6, 50, x, y,
-	    6, 7);
-	x += 6;
+    if (Connection) {
+	xcb_shape_rectangles(Connection, XCB_SHAPE_SO_SET,
+	    XCB_SHAPE_SK_BOUNDING, 0, Dock->Window, 0, 0, len, rectangles);
+    } else {
+	int i;
+	int y;
+
+	memset(Dock->HeadlessShape, 0, sizeof(Dock->HeadlessShape));
+	for (i = 0; i < len; ++i) {
+	    for (y = rectangles[i].y;
+		y < rectangles[i].y + rectangles[i].height && y < 64; ++y) {
+		Dock->HeadlessShape[y] |= (rectangles[i].width >= 64 ? ~0ULL :
+		    (1ULL << rectangles[i].width) - 1) << rectangles[i].x;
+	    }
+	}
     }
-    if (n1000 || n100 || n10) {
-	xcb_copy_area(Connection, Image, Pixmap, NormalGC, n10 * 6, 50, x, y,
-	    6, 7);
-	x += 6;
+}
+
+/**
+**	Prepare our graphic data.
+*/
+void PrepareData(void)
+{
+    int i;
+
+    for (i = 0; i < DockappN; ++i) {
+	Dock = Dockapps + i;
+	DockappPrepare();
     }
-    xcb_copy_area(Connection, Image, Pixmap, NormalGC, n1 * 6, 50, x, y, 6, 7);
+    Timeout();
 }
 
 /**
-**	Draw a number at given cordinates with LCD font.
+**	Run the sample/render loop for one benchmark phase.
 **
-**	@param	num	unsigned number
-**	@param	x	x pixel position
-**	@param	y	y pixel position
+**	@param name	name of the phase
+**	@param redraw	forget all cells, every update redraws all numbers
+**
+**	Prints the costs per update: sensor syscalls, X11 requests, bytes
+**	send to the X11 server, wall and cpu time in microseconds and the
+**	updates per second.  Headless there are no X11 costs.
 */
-void DrawLcdNumber(unsigned num, int x, int y)
+static void BenchPhase(const char *name, int redraw)
 {
-    int n100;
-    int n10;
-    int n1;
+    struct timespec start;
+    struct timespec end;
+    struct rusage ru_start;
+    struct rusage ru_end;
+    xcb_generic_event_t *event;
+    uint64_t written;
+    unsigned syscalls;
+    unsigned sequence;
+    double wall;
+    double cpu;
+    int ticks;
 
-    if (num > 999) {
-	num = 999;
+    sequence = 0;
+    written = 0;
+    if (Connection) {
+	// server idle, all previous requests are done
+	free(xcb_get_input_focus_reply(Connection,
+		xcb_get_input_focus(Connection), NULL));
+	sequence = xcb_no_operation(Connection).sequence;
+	xcb_flush(Connection);
+	written = xcb_total_written(Connection);
     }
+    syscalls = SensorSyscalls;
+    getrusage(RUSAGE_SELF, &ru_start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-    n1 = num % 10;
-    n10 = (num / 10) % 10;
-    n100 = (num / 100) % 10;
+    // a replay in real time ends with the recorded updates
+    for (ticks = 0; ticks < BenchTicks
+	&& !__atomic_load_n(&ReplayDone, __ATOMIC_RELAXED); ++ticks) {
+	if (redraw) {
+	    int j;
 
-    if (n100) {
-	xcb_copy_area(Connection, Image, Pixmap, NormalGC, n100 * 5, 57, x, y,
-	    5, 7);
-    } else {
-	xcb_copy_area(Connection, Image, Pixmap, NormalGC, 2, 24, x, y, 5, 7);
+	    for (j = 0; j < DockappN; ++j) {
+		Dockapps[j].CellN = 0;
+	    }
+	}
+	SamplerTick();
+	Timeout();
+	// only shm completions are expected, FrameSync handles them
+	while (Connection && (event = xcb_poll_for_event(Connection))) {
+	    free(event);
+	}
     }
-    x += 6;
-    if (n100 || n10) {
-	xcb_copy_area(Connection, Image, Pixmap, NormalGC, n10 * 5, 57, x, y,
-	    5, 7);
-    } else {
-	xcb_copy_area(Connection, Image, Pixmap, NormalGC, 2, 24, x, y, 5, 7);
+    if (Connection) {
+	xcb_flush(Connection);
+	written = xcb_total_written(Connection) - written;
+	sequence = xcb_no_operation(Connection).sequence - sequence - 1;
+	free(xcb_get_input_focus_reply(Connection,
+		xcb_get_input_focus(Connection), NULL));
     }
-    x += 7;
-    xcb_copy_area(Connection, Image, Pixmap, NormalGC, n1 * 5, 57, x, y, 5, 7);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_SELF, &ru_end);
+    syscalls = SensorSyscalls - syscalls;
+    wall = (end.tv_sec - start.tv_sec) * 1e6
+	+ (end.tv_nsec - start.tv_nsec) / 1e3;
+    cpu = (ru_end.ru_utime.tv_sec - ru_start.ru_utime.tv_sec
+	+ ru_end.ru_stime.tv_sec - ru_start.ru_stime.tv_sec) * 1e6
+	+ ru_end.ru_utime.tv_usec - ru_start.ru_utime.tv_usec
+	+ ru_end.ru_stime.tv_usec - ru_start.ru_stime.tv_usec;
+
+    if (!ticks) {
+	return;
+    }
+    printf("%s: ticks=%d sensor_syscalls=%.2f requests=%.2f bytes=%.1f "
+	"wall_us=%.2f cpu_us=%.2f fps=%.0f\n", name, ticks,
+	(double)syscalls / ticks, (double)sequence / ticks,
+	(double)written / ticks, wall / ticks, cpu / ticks,
+	wall > 0 ? ticks * 1e6 / wall : 0);
 }
 
-// ------------------------------------------------------------------------- //
+#ifndef MICROBENCH
 
 /**
-**	Read number
+**	Benchmark the costs of an update.
 **
-**	@param file	Name of file containing only the number.
+**	The "idle" phase shows unchanged sensors (the normal case), the
+**	"redraw" phase forces all numbers to be drawn on every update.
+**	A replay as fast as possible has only the "replay" phase, which
+**	draws the recorded updates.
 */
-static int ReadNumber(const char *file)
+static void Bench(void)
 {
-    int fd;
-    int n;
-    char buf[32];
+    if (ReplayName) {
+	ReplayTick = 0;
+	BenchPhase("replay", 0);
+    } else {
+	BenchPhase("idle", 0);
+	BenchPhase("redraw", 1);
+    }
+    if (HeadlessName) {			// last frame for image compare
+	int i;
 
-    n = -1;
-    if ((fd = open(file, O_RDONLY)) >= 0) {
-	n = read(fd, buf, sizeof(buf));
-	if (n > 0) {
-	    buf[n] = '\0';
-	    n = atol(buf);
+	for (i = 0; i < DockappN; ++i) {
+	    Dock = Dockapps + i;
+	    HeadlessWrite();
 	}
-	close(fd);
     }
-    return n;
 }
 
+#endif
+
 /**
-**	Draw temperatures. cpu0, cpu1, chipset
+**	Headless loop, writes a frame for each changed update.
 */
-static void DrawTemperaturs(void)
+static void HeadlessLoop(void)
 {
-    int n;
-    int i;
-    // older linux
-    //static char temp[] = "/sys/devices/platform/coretemp.0/temp1_input";
-    // linux 3.00
-    //static char temp3[] = "/sys/devices/platform/coretemp.0/temp2_input";
-    // linux 4.00
-    //static char temp4[] = "/sys/devices/platform/coretemp.0/hwmon/hwmon0/temp2_input";
-    // linux 5.00
-    static char temp5[] = "/sys/devices/platform/coretemp.0/hwmon/hwmon1/temp2_input";
-
-    switch (Cpus) {
-	case 4:
-	    for (i = 0; i < 4; ++i) {
-//		temp[strlen("/sys/devices/platform/coretemp.")] =
-//		    '0' + StartCpu + (i << JoinCpusTemp);
-//		temp3[strlen("/sys/devices/platform/coretemp.0/temp")] =
-//		    '2' + StartCpu + (i << JoinCpusTemp);
-//		temp4[strlen("/sys/devices/platform/coretemp.0/hwmon/hwmon0/temp")] =
-//		    '2' + StartCpu + (i << JoinCpusTemp);
-		temp5[strlen("/sys/devices/platform/coretemp.0/hwmon/hwmon1/temp")] =
-		    '2' + StartCpu + (i << JoinCpusTemp);
-		n = ReadNumber(temp5);
-		DrawLcdNumber(n / 100, 2 + 2, 2 + i * 12 + 2);
-	    }
-
-	    if (ThermalZones >= 1) {
-		n = ReadNumber(ThermalZoneNames[0]);
-		if (n >= 0) {
-		    DrawLcdNumber(n / 100, 2 + 2, 2 + 49 + 2);
-		}
-	    }
+    struct pollfd fds[2];
+    uint64_t samples;
 
-	    if (ThermalZones >= 2) {
-		n = ReadNumber(ThermalZoneNames[1]);
-		if (n >= 0) {
-		    DrawLcdNumber(n / 100, 2 + 31 + 2, 2 + 49 + 2);
-		}
+    fds[0].fd = SampleFD;
+    fds[0].events = POLLIN;
+    fds[1].fd = SignalFD;		// ignored, if -1
+    fds[1].events = POLLIN;
+    for (;;) {
+	if (poll(fds, 2, -1) < 0) {
+	    if (errno == EINTR) {
+		continue;
 	    }
-
 	    break;
+	}
+	if ((fds[0].revents & POLLIN)
+	    && read(SampleFD, &samples, sizeof(samples)) == sizeof(samples)) {
+	    RateUpdate();
+	    Timeout();
+	}
+	if ((fds[0].revents & POLLIN)
+	    && __atomic_load_n(&ReplayDone, __ATOMIC_ACQUIRE)) {
+	    return;			// end of the replay: clean exit
+	}
+	if (fds[1].revents & POLLIN) {
+	    struct signalfd_siginfo info;
 
-	case 2:
-	default:
-//	    temp[strlen("/sys/devices/platform/coretemp.")] =
-//		'0' + StartCpu + 0
-//	    temp3[strlen("/sys/devices/platform/coretemp.0/temp")] =
-//		'2' + StartCpu + 0;
-//	    temp4[strlen("/sys/devices/platform/coretemp.0/hwmon/hwmon0/temp")] =
-//		'2' + StartCpu + 0;
-	    temp5[strlen("/sys/devices/platform/coretemp.0/hwmon/hwmon1/temp")] =
-		'2' + StartCpu + 0;
-	    n = ReadNumber(temp5);
-	    DrawLcdNumber(n / 100, 3 + 29 + 2, 3 + 2);
-//	    temp[strlen("/sys/devices/platform/coretemp.")] =
-//		'0' + StartCpu + 1
-//	    temp3[strlen("/sys/devices/platform/coretemp.0/temp")] =
-//		'2' + StartCpu + 1;
-//	    temp4[strlen("/sys/devices/platform/coretemp.0/hwmon/hwmon0/temp")] =
-//		'2' + StartCpu + 1;
-	    temp5[strlen("/sys/devices/platform/coretemp.0/hwmon/hwmon1/temp")] =
-		'2' + StartCpu + 1;
-	    n = ReadNumber(temp5);
-	    DrawLcdNumber(n / 100, 3 + 29 + 2, 3 + 15 + 2);
-
-	    // temperature zones
-	    if (ThermalZones >= 2) {
-		n = ReadNumber(ThermalZoneNames[0]);
-		DrawLcdNumber(n / 100, 3 + 2, 3 + 30 + 2);
-
-		n = ReadNumber(ThermalZoneNames[1]);
-		if (n >= 0) {
-		    DrawLcdNumber(n / 100, 3 + 29 + 2, 3 + 30 + 2);
-		}
-	    } else if (ThermalZones >= 1) {
-		n = ReadNumber(ThermalZoneNames[0]);
-		if (n >= 0) {
-		    DrawLcdNumber(n / 100, 3 + 29 + 2, 3 + 30 + 2);
+	    if (read(SignalFD, &info, sizeof(info)) == sizeof(info)) {
+		if (info.ssi_signo != SIGUSR1) {
+		    return;		// SIGINT, SIGTERM: clean exit
 		}
+		MetricsDump();
 	    }
-
-	    break;
+	}
     }
 }
 
+#ifdef MICROBENCH
+
+// ------------------------------------------------------------------------- //
+
+#define MICROBENCH_OPS 10000		///< default operations per repetition
+#define MICROBENCH_REPS 7		///< timed repetitions per benchmark
+
+static volatile unsigned MicroSink;	///< results, not optimized away
+static int *MicroHandles;		///< handles of the file sensors
+static int MicroHandleN;		///< number of file sensors
+
 /**
-**	Draw frequency
+**	Read and parse one sensor file.
+**
+**	@param i	operation number
 */
-static void DrawFrequency(void)
+static void MicroReadNumber(unsigned i)
 {
-    int n;
-    int i;
-    static char flag;
-    static char freq[] =
-	"/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq";
-
-    flag ^= 1;
-    switch (Cpus) {
-	case 4:
-	    for (i = 0; i < 4; ++i) {
-		freq[strlen("/sys/devices/system/cpu/cpu")] =
-		    '0' + StartCpu + (i << JoinCpusFreq) +
-		    (JoinCpusFreq ? flag : 0);
-		n = ReadNumber(freq);
-		if (n >= TurboBoostFreq) {
-		    DrawRedSmallNumber(n / 1000, 2 + 33 + 2, 2 + i * 12 + 2);
-		} else {
-		    DrawSmallNumber(n / 1000, 2 + 33 + 2, 2 + i * 12 + 2);
-		}
+    MicroSink += ReadNumber(MicroHandles[i % MicroHandleN]);
+}
 
-	    }
-	    break;
+/**
+**	Parse a sensor file content.
+**
+**	@param i	operation number
+*/
+static void MicroAtol(unsigned i)
+{
+    static const char *const buf[] = {
+	"40000\n", "54000\n", "800000\n", "3400000\n"
+    };
 
-	case 2:
-	default:
-	    freq[strlen("/sys/devices/system/cpu/cpu")] = '0' + StartCpu + 0;
-	    n = ReadNumber(freq);
-	    if (n >= TurboBoostFreq) {
-		DrawRedSmallNumber(n / 1000, 3 + 2, 46 + 3 + 2);
-	    } else {
-		DrawSmallNumber(n / 1000, 3 + 2, 46 + 3 + 2);
-	    }
-	    freq[strlen("/sys/devices/system/cpu/cpu")] = '0' + StartCpu + 1;
-	    n = ReadNumber(freq);
-	    if (n >= TurboBoostFreq) {
-		DrawRedSmallNumber(n / 1000, 3 + 31 + 2, 46 + 3 + 2);
-	    } else {
-		DrawSmallNumber(n / 1000, 3 + 31 + 2, 46 + 3 + 2);
-	    }
-	    break;
-    }
+    MicroSink += atol(buf[i % 4]);
 }
 
-// ------------------------------------------------------------------------- //
-
 /**
-**	Timeout call back.
+**	Decode the glyph atlas from the XPM data.
+**
+**	@param i	operation number
 */
-void Timeout(void)
+static void MicroXpm2Image(unsigned i)
 {
-    //
-    // Update  everything
-    //
-    DrawTemperaturs();
-    DrawFrequency();
+    xcb_image_t *image;
 
-    xcb_clear_area(Connection, 0, Window, 0, 0, 64, 64);
-    // flush the request
-    xcb_flush(Connection);
+    image = XcbXpm2Image(NULL, 0, NULL, 24, 0UL, (void *)wmc2d_xpm, NULL);
+    MicroSink += image->data[i % image->size];
+    xcb_image_destroy(image);
 }
 
-    /// shape rectangle shortcut macro
-#define _R(i, xx, yy, w, h) \
-    rectangles[i].x = xx; \
-    rectangles[i].y = yy; \
-    rectangles[i].width = w; \
-    rectangles[i].height = h;
+/**
+**	Draw a small font number, digit decomposition and blits.
+**
+**	@param i	operation number
+*/
+static void MicroSmallNumber(unsigned i)
+{
+    Dock->CellN = 0;			// always draw
+    DrawSmallNumber(i % 10000, 3, 3);
+}
 
 /**
-**	Prepare our graphic data.
+**	Draw a LCD font number, digit decomposition and blits.
+**
+**	@param i	operation number
 */
-void PrepareData(void)
+static void MicroLcdNumber(unsigned i)
 {
-    xcb_rectangle_t rectangles[10];
-    int len;
+    Dock->CellN = 0;			// always draw
+    DrawLcdNumber(i % 1000, 3, 3);
+}
 
-    Image = CreatePixmap((void *)wmc2d_xpm, NULL);
-    // clear background
-    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 0, 0, 0, 0, 64, 64);
-
-    switch (Cpus) {
-	case 4:
-	    // temperature
-	    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 0, 22, 2, 2, 29,
-		11);
-	    _R(0, 2, 2, 29, 11);
-	    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 0, 22, 2,
-		12 + 2, 29, 11);
-	    _R(1, 2, 12 + 2, 29, 11);
-	    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 0, 22, 2,
-		24 + 2, 29, 11);
-	    _R(2, 2, 24 + 2, 29, 11);
-	    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 0, 22, 2,
-		36 + 2, 29, 11);
-	    _R(3, 2, 36 + 2, 29, 11);
-	    len = 4;
-	    if (ThermalZones >= 1) {
-		xcb_copy_area(Connection, Image, Pixmap, NormalGC, 0, 22, 2,
-		    2 + 49, 29, 11);
-		_R(len, 2, 2 + 49, 29, 11);
-		++len;
-	    }
-	    if (ThermalZones >= 2) {
-		xcb_copy_area(Connection, Image, Pixmap, NormalGC, 0, 22,
-		    2 + 31, 2 + 49, 29, 11);
-		_R(len, 2 + 31, 2 + 49, 29, 11);
-		++len;
-	    }
-	    // frequency
-	    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 0, 11, 2 + 33,
-		2, 27, 11);
-	    _R(len, 2 + 33, 2, 27, 11);
-	    ++len;
-	    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 0, 11, 2 + 33,
-		12 + 2, 27, 11);
-	    _R(len, 2 + 33, 12 + 2, 27, 11);
-	    ++len;
-	    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 0, 11, 2 + 33,
-		24 + 2, 27, 11);
-	    _R(len, 2 + 33, 24 + 2, 27, 11);
-	    ++len;
-	    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 0, 11, 2 + 33,
-		36 + 2, 27, 11);
-	    _R(len, 2 + 33, 36 + 2, 27, 11);
-	    ++len;
+/**
+**	Compose full frames of all windows.
+**
+**	@param i	operation number
+*/
+static void MicroFrame(unsigned i)
+{
+    int j;
 
-	    break;
+    (void)i;
+    for (j = 0; j < DockappN; ++j) {
+	Dockapps[j].CellN = 0;		// redraw all numbers
+    }
+    Timeout();
+}
 
-	case 2:
-	default:
-	    // text areas cpu
-	    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 0, 0, 3, 3, 26,
-		11);
-	    _R(0, 3, 3, 26, 11);
-	    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 0, 0, 3, 15 + 3,
-		26, 11);
-	    _R(1, 3, 15 + 3, 26, 11);
-	    // text cpu
-	    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 29, 0, 5, 5, 23,
-		7);
-	    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 29, 7, 5,
-		15 + 5, 23, 7);
-	    // temperature cpu
-	    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 0, 22, 3 + 29,
-		3, 29, 11);
-	    _R(2, 3 + 29, 3, 29, 11);
-	    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 0, 22, 3 + 29,
-		15 + 3, 29, 11);
-	    _R(3, 3 + 29, 15 + 3, 29, 11);
-
-	    // frequency
-	    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 0, 11, 3,
-		46 + 3, 27, 11);
-	    _R(4, 3, 46 + 3, 27, 11);
-	    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 0, 11, 3 + 31,
-		46 + 3, 27, 11);
-	    _R(5, 3 + 31, 46 + 3, 27, 11);
-	    len = 6;
-
-	    if (ThermalZones >= 1) {
-		if (ThermalZones == 1) {
-		    // text area for only 1 zone
-		    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 0, 0, 3,
-			30 + 3, 26, 11);
-		    _R(6, 3, 3 + 30, 26, 11);
-		    // text for only 1 zone
-		    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 29, 14,
-			5, 3 + 30 + 2, 23, 7);
-		} else {
-		    // temperature area for zone
-		    xcb_copy_area(Connection, Image, Pixmap, NormalGC, 0, 22,
-			3, 3 + 30, 29, 11);
-		    _R(6, 3, 3 + 30, 29, 11);
-		}
+/**
+**	Compare two repetition times for qsort.
+**
+**	@param a	first time
+**	@param b	second time
+*/
+static int MicroCompare(const void *a, const void *b)
+{
+    return *(const uint64_t *)a < *(const uint64_t *)b ? -1
+	: *(const uint64_t *)a > *(const uint64_t *)b;
+}
 
-		// temperature area zone 2 or 1
-		xcb_copy_area(Connection, Image, Pixmap, NormalGC, 0, 22,
-		    3 + 29, 30 + 3, 29, 11);
-		_R(7, 3 + 29, 30 + 3, 29, 11);
-		len = 8;
-	    }
+/**
+**	Run one micro benchmark.
+**
+**	@param name	benchmark name
+**	@param op	operation to measure
+**	@param ops	number of operations per repetition
+**
+**	After a warmup of a tenth of the operations, #MICROBENCH_REPS
+**	repetitions are timed.  One line with the minimum, median and
+**	maximum ns per operation is printed.
+*/
+static void MicroRun(const char *name, void (*op) (unsigned), unsigned ops)
+{
+    uint64_t ns[MICROBENCH_REPS];
+    uint64_t start;
+    unsigned i;
+    int r;
 
-	    break;
+    for (i = 0; i < ops / 10 + 1; ++i) {
+	op(i);
+    }
+    for (r = 0; r < MICROBENCH_REPS; ++r) {
+	start = NowNs();
+	for (i = 0; i < ops; ++i) {
+	    op(i);
+	}
+	ns[r] = NowNs() - start;
     }
+    qsort(ns, MICROBENCH_REPS, sizeof(*ns), MicroCompare);
 
-    xcb_shape_rectangles(Connection, XCB_SHAPE_SO_SET, XCB_SHAPE_SK_BOUNDING,
-	0, Window, 0, 0, len, rectangles);
+    printf("%s: ops=%u reps=%d min_ns=%.1f median_ns=%.1f max_ns=%.1f\n",
+	name, ops, MICROBENCH_REPS, (double)ns[0] / ops,
+	(double)ns[MICROBENCH_REPS / 2] / ops,
+	(double)ns[MICROBENCH_REPS - 1] / ops);
+    fflush(stdout);
+}
 
-    Timeout();
+/**
+**	Micro benchmarks of the parsing and glyph paths.
+**
+**	Built as wmc2d-microbench (make microbench), always headless.  -b n
+**	sets the operations per repetition, the XPM decode uses a hundredth.
+**	The last lines are the update phases of the normal benchmark.
+*/
+static void MicroBench(void)
+{
+    int i;
+
+    MicroHandles = malloc(SensorN * sizeof(*MicroHandles));
+    if (!MicroHandles) {
+	fprintf(stderr, "out of memory\n");
+	abort();
+    }
+    for (i = 0; i < SensorN; ++i) {
+	if (!Sensors[i].Virtual) {
+	    MicroHandles[MicroHandleN++] = i;
+	}
+    }
+    if (MicroHandleN) {
+	MicroRun("read_number", MicroReadNumber, BenchTicks);
+    }
+    MicroRun("atol", MicroAtol, BenchTicks);
+    MicroRun("xpm2image", MicroXpm2Image, BenchTicks / 100 + 1);
+    Dock = Dockapps;
+    MicroRun("small_number", MicroSmallNumber, BenchTicks);
+    MicroRun("lcd_number", MicroLcdNumber, BenchTicks);
+    MicroRun("frame", MicroFrame, BenchTicks);
+    free(MicroHandles);
+    // whole updates, sampling and composition, like -b
+    BenchPhase("idle", 0);
+    BenchPhase("redraw", 1);
 }
 
+#endif
+
 // ------------------------------------------------------------------------- //
 
 /**
@@ -1104,19 +6022,38 @@ static void PrintVersion(void)
 static void PrintUsage(void)
 {
     printf
-	("Usage: wmc2d [-?|-h][-jJsw][-0 z0] [-1 -z1] [-c n] [-n n] [-r rate] [-t f] [-z n]\n"
+	("Usage: wmc2d [-?|-h][-aegjJsuvw][-0 z0] [-1 -z1] [-b n] [-c n] [-k file[:kb]] [-K file] [-l n] [-m c:n[:a|g]] [-n n] [-o ppm] [-p n] [-P file[:f]] [-r rate[:max]] [-R dir] [-t f] [-T us] [-x shm] [-X shm] [-z n] [-Z zones]\n"
 	"\t-?|-h\tshow this help page\n"
+	"\t-a\tshow max/mean/min of all CPUs, spread and hottest CPU\n"
+	"\t-e\teffective frequency from APERF/MPERF or perf counters\n"
+	"\t-g\tshow graph of the hottest CPU temperature\n"
 	"\t-j\tjoin two CPUs frequency (for hyper-threading CPUs)\n"
 	"\t-J\tjoin two CPUs temperature (for hyper-threading CPUs)\n"
-	"\t-s\tsleep while screen-saver is running or video is blanked\n"
+	"\t-s\tsleep while screen-saver runs, video is off or window hidden\n"
+	"\t-u\tshow CPUs, which throttled since the last update, in red\n"
+	"\t-v\tverbose, print sensor statistics\n"
 	"\t-w\tstart in window mode\n"
-	"\t-0 z0\tfile name of thermal zone 0 (defaults to ACPI Zone0)\n"
-	"\t-1 z1\tfile name of thermal zone 1 (defaults to ACPI Zone1)\n"
+	"\t-0 z0\tthermal zone 0: file, type or label (default ACPI Zone0)\n"
+	"\t-1 z1\tthermal zone 1: file, type or label (default ACPI Zone1)\n"
+	"\t-b n\tbenchmark n updates and print the costs per update\n"
 	"\t-c n\tfirst CPU to use (to monitor more than 4 cores)\n"
-	"\t-n n\tnumber of CPU to display (2 or 4)\n"
+	"\t-k file[:kb]\trecord samples into a ring file (default 4096 KiB)\n"
+	"\t-K file\tprint the samples recorded with -k and exit\n"
+	"\t-l n\tlayout: CPUs shown at once (2, 4 or 8 temperatures only)\n"
+	"\t-m c:n[:a|g]\tone more window: first CPU, CPUs [aggregate|graph]\n"
+	"\t-n n\tnumber of CPU to display (>= 2, 4 shown at once)\n"
+	"\t-o ppm\theadless, write frames as PPM (%%d is the update number)\n"
+	"\t-p n\tupdates before next page of CPUs (0 no paging, default 2)\n"
+	"\t-P file[:f]\treplay a record (:f as fast as possible)\n"
 	"\t-r rate\trefresh rate (in milliseconds, default 1500 ms)\n"
+	"\t-r min:max\tadaptive refresh rate, faster while temperatures move\n"
+	"\t-R dir\troot directory for all /sys files (f.e. a test tree)\n"
 	"\t-t f\t>= turbo boost frequency in Hz (f.e. 1734000 for 1.73 GHz)\n"
-	"\t-z n\tnumber of thermal zones (0, 1 or 2)\n"
+	"\t-T us\ttimer slack 1-1000000 (in microseconds, default 50 us)\n"
+	"\t-x shm\texport all samples into POSIX shared memory (f.e. /wmc2d)\n"
+	"\t-X shm\tprint the samples exported by another wmc2d and exit\n"
+	"\t-z n\tnumber of thermal zones (0 - 16, more than 2 are paged)\n"
+	"\t-Z z,..\tthermal zones by type or label (f.e. acpitz,nvme)\n"
 	"Only idiots print usage on stderr!\n");
 }
 
@@ -1128,23 +6065,42 @@ static void PrintUsage(void)
 */
 int main(int argc, char *const argv[])
 {
+    int i;
+
+    StartTime = NowNs();
     Rate = 1500;			// 1500 ms default update rate
-    Cpus = 2;				// two cpus default
+    TimerSlack = 50;			// 50 us default timer slack
+    Dock = Dockapps;			// first window from -a -c -g -n
+    DockappN = 1;
+    Dock->Cpus = 2;			// two cpus default
+    PageTicks = 2;			// 2 updates per page of cpus
     ThermalZones = 1;			// one thermal zone default
 
     //
     //	Parse arguments.
     //
     for (;;) {
-	switch (getopt(argc, argv, "h?-0:1:c:jJn:r:st:wz:")) {
-	    case '0':			// thermal zone 0: name
+	switch (getopt(argc, argv, "h?-0:1:ab:c:egjJk:K:l:m:n:o:p:P:r:R:st:T:uvwx:X:z:Z:")) {
+	    case '0':			// thermal zone 0: file, type or label
 		ThermalZoneNames[0] = optarg;
 		continue;
-	    case '1':			// thermal zone 1: name
+	    case '1':			// thermal zone 1: file, type or label
 		ThermalZoneNames[1] = optarg;
 		continue;
+	    case 'a':			// aggregate all cpus
+		Dock->Aggregate = 1;
+		continue;
+	    case 'b':			// benchmark updates
+		BenchTicks = atoi(optarg);
+		continue;
 	    case 'c':			// cpu start
-		StartCpu = atoi(optarg);
+		Dock->StartCpu = atoi(optarg);
+		continue;
+	    case 'e':			// effective frequency
+		EffectiveFreq = 1;
+		continue;
+	    case 'g':			// graph of hottest cpu
+		Dock->Graph = 1;
 		continue;
 	    case 'j':			// join cpu's
 		JoinCpusFreq = 1;
@@ -1152,17 +6108,71 @@ int main(int argc, char *const argv[])
 	    case 'J':			// join cpu's
 		JoinCpusTemp = 1;
 		continue;
+	    case 'l':			// layout: cpus displayed at once
+		Layout = atoi(optarg);
+		if (Layout < 2 || !LayoutFind(Layout)) {
+		    PrintVersion();
+		    fprintf(stderr, "Sorry no layout for %d cpus\n", Layout);
+		    return -1;
+		}
+		continue;
+	    case 'm':			// more windows: first:cpus[:a|g]
+		if (DockappN >= DOCKAPP_MAX) {
+		    PrintVersion();
+		    fprintf(stderr, "Sorry only %d windows are supported\n",
+			DOCKAPP_MAX);
+		    return -1;
+		} else {
+		    Dockapp *dockapp;
+		    char mode;
+
+		    dockapp = Dockapps + DockappN++;
+		    mode = '\0';
+		    if (sscanf(optarg, "%d:%d:%c", &dockapp->StartCpu,
+			    &dockapp->Cpus, &mode) < 2 || dockapp->Cpus < 2
+			|| (mode && mode != 'a' && mode != 'g')) {
+			PrintVersion();
+			fprintf(stderr, "Unsupported window '%s'\n", optarg);
+			return -1;
+		    }
+		    dockapp->Aggregate = mode == 'a';
+		    dockapp->Graph = mode == 'g';
+		}
+		continue;
 	    case 'n':			// number of cpus/cores
-		Cpus = atoi(optarg);
-		if (Cpus != 2 && Cpus != 4) {
+		Dock->Cpus = atoi(optarg);
+		if (Dock->Cpus < 2) {
 		    PrintVersion();
 		    fprintf(stderr,
-			"Sorry %d cpu(s)/core(s) aren't supported\n", Cpus);
+			"Sorry %d cpu(s)/core(s) aren't supported\n",
+			Dock->Cpus);
+		    return -1;
+		}
+		continue;
+	    case 'o':			// headless ppm output
+		HeadlessName = optarg;
+		continue;
+	    case 'p':			// updates per page
+		PageTicks = atoi(optarg);
+		if (PageTicks < 0) {
+		    PrintVersion();
+		    fprintf(stderr, "Unsupported updates per page '%s'\n",
+			optarg);
+		    return -1;
+		}
+		continue;
+	    case 'r':			// update rate, adaptive min:max
+		RateMax = 0;
+		if (sscanf(optarg, "%d:%d", &Rate, &RateMax) < 1 || Rate <= 0
+		    || (RateMax && RateMax < Rate)) {
+		    PrintVersion();
+		    fprintf(stderr, "Unsupported rate '%s'\n", optarg);
 		    return -1;
 		}
+		RateMin = Rate;
 		continue;
-	    case 'r':			// update rate
-		Rate = atoi(optarg);
+	    case 'R':			// sysfs root directory
+		SysRoot = optarg;
 		continue;
 	    case 's':			// sleep while screensaver running
 		UseSleep = 1;
@@ -1170,9 +6180,33 @@ int main(int argc, char *const argv[])
 	    case 't':			// >= turbo boost frequency
 		TurboBoostFreq = atoi(optarg);
 		continue;
+	    case 'u':			// show throttled cpus
+		ThrottleShow = 1;
+		continue;
+	    case 'k':			// record into ring file
+		RecordName = optarg;
+		continue;
+	    case 'K':			// print recorded updates
+		return RecordRead(optarg);
+	    case 'P':			// replay recorded updates
+		ReplayName = optarg;
+		continue;
+	    case 'x':			// export into shared memory
+		ExportName = optarg;
+		if (*optarg != '/' || strchr(optarg + 1, '/')
+		    || strlen(optarg) > NAME_MAX - 16) {
+		    PrintVersion();
+		    fprintf(stderr,
+			"Sorry shared memory name '%s' isn't /name\n",
+			optarg);
+		    return -1;
+		}
+		continue;
+	    case 'X':			// read shared memory export
+		return ExportRead(optarg);
 	    case 'z':			// number of thermal zones
 		ThermalZones = atoi(optarg);
-		if (ThermalZones < 0 || ThermalZones > 2) {
+		if (ThermalZones < 0 || ThermalZones > ZONE_MAX) {
 		    PrintVersion();
 		    fprintf(stderr,
 			"Sorry %d themal zone(s) aren't supported\n",
@@ -1180,6 +6214,35 @@ int main(int argc, char *const argv[])
 		    return -1;
 		}
 		continue;
+	    case 'Z':			// thermal zones: comma separated names
+		{
+		    char *zone;
+
+		    // argv is kept for WM_COMMAND, split a copy
+		    ThermalZones = 0;
+		    for (zone = strtok(strdup(optarg), ","); zone;
+			zone = strtok(NULL, ",")) {
+			if (ThermalZones >= ZONE_MAX) {
+			    PrintVersion();
+			    fprintf(stderr, "Sorry only %d themal zones are "
+				"supported\n", ZONE_MAX);
+			    return -1;
+			}
+			ThermalZoneNames[(int)ThermalZones++] = zone;
+		    }
+		}
+		continue;
+	    case 'T':			// timer slack
+		TimerSlack = atoi(optarg);
+		if (TimerSlack < 1 || TimerSlack > 1000000) {
+		    PrintVersion();
+		    fprintf(stderr, "Unsupported timer slack '%s'\n", optarg);
+		    return -1;
+		}
+		continue;
+	    case 'v':			// verbose statistics
+		Verbose = 1;
+		continue;
 	    case 'w':			// window mode
 		WindowMode = 1;
 		continue;
@@ -1214,10 +6277,87 @@ int main(int argc, char *const argv[])
 	return -1;
     }
 
-    Init(argc, argv);
+    // 2 or 4 cpus at once, 1 graph, or the layout given with -l
+    for (i = 0; i < DockappN; ++i) {
+	Dockapps[i].Slots = Dockapps[i].Graph ? 1 : Dockapps[i].Aggregate ? 4
+	    : Layout ? Layout : Dockapps[i].Cpus >= 4 ? 4 : 2;
+	// like the original 2 cpu display, the two cpus are never joined
+	Dockapps[i].JoinTemp = Dockapps[i].Cpus > 2 && JoinCpusTemp;
+	Dockapps[i].JoinFreq = Dockapps[i].Cpus > 2 && JoinCpusFreq;
+	if (!Dockapps[i].Graph && !Dockapps[i].Aggregate
+	    && Dockapps[i].Slots > Dockapps[i].Cpus) {
+	    PrintVersion();
+	    fprintf(stderr, "Sorry layout for %d cpus shows only %d cpus\n",
+		Dockapps[i].Slots, Dockapps[i].Cpus);
+	    return -1;
+	}
+    }
+
+    if (SysRoot
+	&& (SysRootFD =
+	    open(SysRoot, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+	PrintVersion();
+	fprintf(stderr, "Can't open sysfs root '%s'\n", SysRoot);
+	return -1;
+    }
+#ifdef MICROBENCH
+    // no X11 server, frames are composed but not written
+    HeadlessName = "microbench.ppm";
+    if (BenchTicks <= 0) {
+	BenchTicks = MICROBENCH_OPS;
+    }
+#endif
+
+    if (HeadlessName) {
+	const char *s;
 
+	// the name is used as format, allow only one %d
+	s = strchr(HeadlessName, '%');
+	if (s && (s[1 + strspn(s + 1, "0123456789")] != 'd'
+		|| strchr(s + 1, '%'))) {
+	    PrintVersion();
+	    fprintf(stderr, "Only one %%d is allowed in '%s'\n",
+		HeadlessName);
+	    return -1;
+	}
+    } else if (Init(argc, argv)) {
+	return -1;
+    }
+
+    SensorSetup();
+    if (ExportName && ExportSetup()) {
+	return -1;
+    }
+    if (RecordName && RecordSetup(RecordName)) {
+	return -1;
+    }
+    if (ReplayName) {
+	if (ReplaySetup()) {
+	    return -1;
+	}
+	if (ReplayFast && !BenchTicks) {	// each recorded update once
+	    BenchTicks = Replay.Ticks;
+	}
+    }
+    SignalSetup();			// before the sampler thread
+    if (SamplerStart()) {
+	return -1;
+    }
     PrepareData();
-    Loop();
+    if (BenchTicks > 0) {
+#ifdef MICROBENCH
+	MicroBench();
+#else
+	Bench();
+#endif
+    } else if (HeadlessName) {
+	HeadlessLoop();
+    } else {
+	Loop();
+    }
+    SamplerStop();
+    ExportExit();
+    RecordExit();
     Exit();
 
     return 0;